@@ -0,0 +1,23 @@
+#!/bin/sh
+# Time bench/cons_scaling.tl at increasing list lengths, and fail if
+# quadrupling the length takes more than eight times as long.
+# Usage: bench/cons_scaling.sh [tlisp options]
+
+cd "$(dirname "$0")/.."
+tmp=$(mktemp)
+trap 'rm -f $tmp' EXIT
+prev=
+
+for n in 100000 400000 1600000; do
+    sed "s/(def n [0-9]*)/(def n $n)/" bench/cons_scaling.tl > $tmp
+    start=$(date +%s.%N)
+    bin/tlisp "$@" $tmp > /dev/null || exit 1
+    end=$(date +%s.%N)
+    secs=$(awk -v s=$start -v e=$end 'BEGIN { printf "%.3f", e - s }')
+    echo "$n conses: ${secs}s"
+    if [ -n "$prev" ] && awk -v p=$prev -v s=$secs 'BEGIN { exit !(s > 8 * p && s > 0.5) }'; then
+        echo "Not linear."
+        exit 1
+    fi
+    prev=$secs
+done
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Time bench/gc_scaling.tl with an increasing number of collector
+# threads. Usage: bench/gc_scaling.sh [max threads]
+
+cd "$(dirname "$0")/.."
+max=${1:-8}
+n=1
+
+while [ $n -le $max ]; do
+    start=$(date +%s.%N)
+    bin/tlisp -t $n bench/gc_scaling.tl > /dev/null || exit 1
+    end=$(date +%s.%N)
+    awk -v n=$n -v s=$start -v e=$end 'BEGIN { printf "%2d threads: %.3fs\n", n, e - s }'
+    n=$((n * 2))
+done
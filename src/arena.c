@@ -0,0 +1,115 @@
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define HEADER_SIZE ALIGN(sizeof(arena_block_t))
+#define LARGE_SIZE ((ARENA_BLOCK_SIZE - HEADER_SIZE) / 4)
+
+static arena_block_t *free_blocks = NULL;
+
+static
+arena_block_t *new_block(arena_t *arena)
+{
+    arena_block_t *block;
+
+    // Blocks are aligned to their size so that arena_of can find
+    // the header from anything allocated inside one.
+    if (!free_blocks) {
+        char *slab = aligned_alloc(ARENA_BLOCK_SIZE, ARENA_SLAB_SIZE);
+        size_t i;
+
+        if (!slab) return NULL;
+        for (i = 0; i < ARENA_SLAB_SIZE; i += ARENA_BLOCK_SIZE) {
+            block = (arena_block_t *)(slab + i);
+            block->next = free_blocks;
+            free_blocks = block;
+        }
+    }
+    block = free_blocks;
+    free_blocks = block->next;
+    block->arena = arena;
+    block->used = HEADER_SIZE;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->size += ARENA_BLOCK_SIZE;
+    return block;
+}
+
+arena_t *arena_new(void)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+
+    arena->blocks = NULL;
+    arena->large = NULL;
+    arena->size = 0;
+    arena->live = 1;
+    arena->next = NULL;
+    return arena;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    arena_block_t *block = arena->blocks;
+    void *res;
+
+    size = ALIGN(size);
+
+    // Long string literals get an allocation of their own rather
+    // than wasting most of a block. Objects never do, so they can
+    // always be traced back to their arena.
+    if (size > LARGE_SIZE) {
+        arena_large_t *large = malloc(ALIGN(sizeof(arena_large_t)) + size);
+
+        if (!large) return NULL;
+        large->next = arena->large;
+        arena->large = large;
+        arena->size += size;
+        return (char *)large + ALIGN(sizeof(arena_large_t));
+    }
+    if (!block || ARENA_BLOCK_SIZE - block->used < size) {
+        block = new_block(arena);
+        if (!block) return NULL;
+    }
+    res = (char *)block + block->used;
+    block->used += size;
+    return res;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *res = arena_alloc(arena, len + 1);
+
+    if (res) {
+        memcpy(res, str, len);
+        res[len] = 0;
+    }
+    return res;
+}
+
+arena_t *arena_of(const void *ptr)
+{
+    arena_block_t *block = (arena_block_t *)((uintptr_t)ptr & ~(uintptr_t)(ARENA_BLOCK_SIZE - 1));
+    return block->arena;
+}
+
+void arena_destroy(arena_t *arena)
+{
+    arena_block_t *block = arena->blocks;
+    arena_large_t *large = arena->large;
+
+    while (block) {
+        arena_block_t *next = block->next;
+        block->next = free_blocks;
+        free_blocks = block;
+        block = next;
+    }
+    while (large) {
+        arena_large_t *next = large->next;
+        free(large);
+        large = next;
+    }
+    free(arena);
+}
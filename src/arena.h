@@ -0,0 +1,41 @@
+#ifndef TLISP_ARENA_H_
+#define TLISP_ARENA_H_
+
+#include <stddef.h>
+
+// Bump arenas for the objects the reader builds. Everything read
+// from one source lives and dies together, so nothing is freed on
+// its own; the whole arena goes in one arena_destroy.
+//
+// Arenas grow a block at a time. Blocks are carved out of larger
+// slabs and recycled between arenas, so reading and releasing many
+// small sources (REPL lines, say) doesn't grow the process.
+
+#define ARENA_BLOCK_SIZE 4096 /* 4 KB */
+#define ARENA_SLAB_SIZE 65536 /* 64 KB */
+
+typedef struct arena_block_t {
+    struct arena_t *arena;
+    struct arena_block_t *next;
+    size_t used;
+} arena_block_t;
+
+typedef struct arena_large_t {
+    struct arena_large_t *next;
+} arena_large_t;
+
+typedef struct arena_t {
+    arena_block_t *blocks;
+    arena_large_t *large;
+    size_t size;
+    int live;
+    struct arena_t *next;
+} arena_t;
+
+arena_t *arena_new(void);
+void *arena_alloc(arena_t *, size_t);
+char *arena_strndup(arena_t *, const char *, size_t);
+arena_t *arena_of(const void *);
+void arena_destroy(arena_t *);
+
+#endif
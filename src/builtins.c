@@ -1,9 +1,15 @@
 
 #include "builtins.h"
 #include "dict.h"
+#include "gc.h"
+#include "intern.h"
 #include "list.h"
+#include "pool.h"
 #include "process.h"
+#include "strbuf.h"
 #include "vector.h"
+#include "vm.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,14 +32,6 @@ tlisp_obj_t *tlisp_bool(int c_bool)
     return c_bool ? tlisp_true : tlisp_false;
 }
 
-static
-tlisp_obj_t *num_cpy(tlisp_obj_t *obj, process_t *proc)
-{
-    tlisp_obj_t *res = proc_new_num(proc);
-    res->num = obj->num;
-    return res;
-}
-
 static
 int nargs(tlisp_obj_t *args)
 {
@@ -43,7 +41,7 @@ int nargs(tlisp_obj_t *args)
 static
 void assert_fn(tlisp_obj_t *obj, process_t *proc)
 {
-    if (obj->tag != NFUNC && obj->tag != LAMBDA) {
+    if (OBJ_TAG(obj) != NFUNC && OBJ_TAG(obj) != LAMBDA) {
         char errstr[256];
         char objstr[128];
         snprintf(errstr, 256, "ERROR: Wrong type for %s. Expected function.\n",
@@ -55,11 +53,11 @@ void assert_fn(tlisp_obj_t *obj, process_t *proc)
 static
 void assert_type(tlisp_obj_t *obj, enum obj_tag_t expected, process_t *proc)
 {
-    if (obj->tag != expected) {
+    if (OBJ_TAG(obj) != expected) {
         char errstr[256];
         char objstr[128];
         snprintf(errstr, 256, "ERROR: Wrong type for %s (%s). Expected %s.\n",
-                 obj_nstr(obj, objstr, 128), tag_str(obj->tag), tag_str(expected));
+                 obj_nstr(obj, objstr, 128), tag_str(OBJ_TAG(obj)), tag_str(expected));
         proc_fatal(proc, errstr);
     }
 }
@@ -87,12 +85,26 @@ tlisp_obj_t *arg_at(int idx, tlisp_obj_t *args)
     return args->car;
 }
 
+// Evaluates site->car. A local the resolver found a slot for is
+// loaded from the slot when it's still the one in scope.
 static
-tlisp_obj_t *apply_lambda(tlisp_obj_t *fn, tlisp_obj_t *args, env_t *env)
+tlisp_obj_t *eval_car(tlisp_obj_t *site, env_t *env)
+{
+    tlisp_obj_t *obj = site->car;
+
+    if (OBJ_TAG(obj) == SYMBOL && !IS_COMPACT(site) && site->ic_idx) {
+        tlisp_obj_t *val = env_find_slot(env, obj, site->ic_idx);
+        if (val) {
+            return val;
+        }
+    }
+    return eval(obj, env);
+}
+
+static
+void bind_args(tlisp_obj_t *fn, tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *arg_list = fn->car;
-    tlisp_obj_t *body = fn->cdr;
-    tlisp_obj_t *res;
 
     while (arg_list || args) {
         if (!arg_list) {
@@ -101,14 +113,84 @@ tlisp_obj_t *apply_lambda(tlisp_obj_t *fn, tlisp_obj_t *args, env_t *env)
         if (!args) {
             proc_fatal(env->proc, "ERROR: Too few arguments.\n");
         }
-        env_add(env, arg_list->car->sym, eval(args->car, env));
+        env_add(env, arg_list->car, eval_car(args, env));
         arg_list = arg_list->cdr;
         args = args->cdr;
     }
-    while (body) {
-        res = eval(body->car, env);
-        body = body->cdr;
+}
+
+// Runs a lambda's body in env, its frame, with the arguments already
+// bound. The last form is in tail position, as are the branches of an
+// if and the last form of a do there. A call to a lambda from tail
+// position reuses env for the callee and loops, rather than nesting
+// another call, when the callee's bindings shadow all of env's.
+// Otherwise the callee could still see them, since scoping is
+// dynamic, and the call is made as usual.
+tlisp_obj_t *run_lambda(tlisp_obj_t *fn, env_t *env)
+{
+    process_t *proc = env->proc;
+    tlisp_obj_t *callee = NULL;
+    tlisp_obj_t *site;
+    tlisp_obj_t *form;
+    tlisp_obj_t *args;
+    tlisp_obj_t *res;
+
+    proc_push_root(proc, &fn);
+    proc_push_root(proc, &callee);
+    while (1) {
+        if (fn->code) {
+            res = vm_run(fn->code, env);
+            break;
+        }
+        for (site = fn->cdr; site->cdr; site = site->cdr) {
+            eval_car(site, env);
+        }
+    tail:
+        form = site->car;
+        if (OBJ_TAG(form) != CONS) {
+            res = eval_car(site, env);
+            break;
+        }
+        callee = eval_car(form, env);
+        args = form->cdr;
+        if (OBJ_TAG(callee) == NFUNC && callee->fn == tlisp_if
+            && (nargs(args) == 2 || nargs(args) == 3)) {
+            if (is_true(eval_car(args, env))) {
+                site = args->cdr;
+                goto tail;
+            }
+            if (args->cdr->cdr) {
+                site = args->cdr->cdr;
+                goto tail;
+            }
+            res = tlisp_nil;
+            break;
+        }
+        if (OBJ_TAG(callee) == NFUNC && callee->fn == tlisp_do && args) {
+            for (site = args; site->cdr; site = site->cdr) {
+                eval_car(site, env);
+            }
+            goto tail;
+        }
+        if (OBJ_TAG(callee) == LAMBDA) {
+            env_t inner_env;
+
+            env_init(&inner_env, env, proc);
+            bind_args(callee, args, &inner_env);
+            if (env_shadows(&inner_env, env)) {
+                env_replace(env, &inner_env);
+                env_destroy(&inner_env);
+                fn = callee;
+                continue;
+            }
+            res = run_lambda(callee, &inner_env);
+            env_destroy(&inner_env);
+            break;
+        }
+        res = apply_obj(callee, args, env);
+        break;
     }
+    proc_pop_roots(proc, 2);
     return res;
 }
 
@@ -126,13 +208,14 @@ tlisp_obj_t *apply_macro(tlisp_obj_t *macro, tlisp_obj_t *args, env_t *env)
         if (!args) {
             proc_fatal(env->proc, "ERROR: Too few arguments.\n");
         }
-        env_add(env, arg_list->car->sym, args->car);
+        env_add(env, arg_list->car, args->car);
         arg_list = arg_list->cdr;
         args = args->cdr;
     }
-    body->car = eval(body->car, env);
+    body->car = eval_car(body, env);
+    gc_write_barrier(env->proc, body, body->car);
     while (body) {
-        res = eval(body->car, env);
+        res = eval_car(body, env);
         body = body->cdr;
     }
     return res;
@@ -141,13 +224,14 @@ tlisp_obj_t *apply_macro(tlisp_obj_t *macro, tlisp_obj_t *args, env_t *env)
 static 
 tlisp_obj_t *apply_fn(tlisp_obj_t *fn, tlisp_obj_t *args, env_t *env)
 {
-    if (fn->tag == NFUNC) {
+    if (OBJ_TAG(fn) == NFUNC) {
         return fn->fn(args, env);
     } else {
         env_t inner_env;
         tlisp_obj_t *res;
         env_init(&inner_env, env, env->proc);
-        res = apply_lambda(fn, args, &inner_env);
+        bind_args(fn, args, &inner_env);
+        res = run_lambda(fn, &inner_env);
         env_destroy(&inner_env);
         return res;
     }
@@ -160,6 +244,8 @@ tlisp_obj_t *apply_1arity_fn(tlisp_obj_t *fn, tlisp_obj_t *arg, env_t *env)
     arglist.tag = CONS;
     arglist.car = arg;
     arglist.cdr = NULL;
+    arglist.ic_sdef = NULL;
+    arglist.ic_idx = 0;
     return apply_fn(fn, &arglist, env);
 }
 
@@ -173,9 +259,13 @@ tlisp_obj_t *apply_2arity_fn(tlisp_obj_t *fn,
     cons1.tag = CONS;
     cons1.car = arg1;
     cons1.cdr = &cons2;
+    cons1.ic_sdef = NULL;
+    cons1.ic_idx = 0;
     cons2.tag = CONS;
     cons2.car = arg2;
     cons2.cdr = NULL;
+    cons2.ic_sdef = NULL;
+    cons2.ic_idx = 0;
     return apply_fn(fn, &cons1, env);
 }
 
@@ -189,51 +279,135 @@ tlisp_obj_t *create_struct(tlisp_obj_t *structdef, tlisp_obj_t *args, env_t *env
     if (nargs(args) > nfields) {
         proc_fatal(env->proc, "ERROR: Too many fields to instantiate struct.\n");
     }
-    structobj = proc_new_struct(env->proc);
+    structobj = proc_new_struct(env->proc, nfields);
     structobj->structobj.sdef = &structdef->structdef;
-    structobj->structobj.fields = malloc(sizeof(tlisp_obj_t *) * nfields);
+    for (fieldnum = 0; fieldnum < nfields; fieldnum++) {
+        structobj->structobj.fields[fieldnum] = tlisp_nil;
+    }
+    fieldnum = 0;
+    proc_push_root(env->proc, &structobj);
     while (args) {
-        structobj->structobj.fields[fieldnum] = eval(args->car, env);
+        structobj->structobj.fields[fieldnum] = eval_car(args, env);
+        gc_write_barrier(env->proc, structobj, structobj->structobj.fields[fieldnum]);
         args = args->cdr;
         fieldnum++;
     }
-    while (fieldnum < nfields) {
-        structobj->structobj.fields[fieldnum] = tlisp_nil;
-        fieldnum++;
-    }
+    proc_pop_roots(env->proc, 1);
     return structobj;
 }
 
+// Resolves the field named by site->car, caching the structdef and
+// index on the site unless it's a compact cons. A hit also checks
+// the index and name, since a structdef may be freed and another,
+// perhaps with fewer fields, allocated in its place.
 static
-tlisp_obj_t *get_struct_field(tlisp_obj_t *structobj, tlisp_obj_t *args, env_t *env)
+int struct_field_index(tlisp_obj_t *site, tlisp_obj_t *structobj, process_t *proc)
 {
-    tlisp_obj_t *field;
-    tlisp_obj_t *res;
-
-    assert_nargs(1, args, env->proc);
-    field = arg_at(0, args);
-    assert_type(field, SYMBOL, env->proc);
-    res = struct_get_field(&structobj->structobj, field->sym);
-    if (!res) {
+    tlisp_structdef_t *sdef = structobj->structobj.sdef;
+    tlisp_obj_t *field = site->car;
+    int cacheable = !IS_COMPACT(site);
+    int idx;
+
+    assert_type(field, SYMBOL, proc);
+    if (cacheable && site->ic_sdef == sdef && site->ic_idx < sdef->nfields
+        && sdef->field_names[site->ic_idx] == field->sym) {
+        return site->ic_idx;
+    }
+    idx = structdef_field_index(sdef, field->sym);
+    if (idx < 0) {
         char errstr[256];
         char objstr[128];
         snprintf(errstr, 256, "ERROR: No field %s in %s.\n",
                  field->sym, obj_nstr(structobj, objstr, 128));
-        proc_fatal(env->proc, errstr);
+        proc_fatal(proc, errstr);
     }
-    return res;
+    if (cacheable && idx <= USHRT_MAX) {
+        site->ic_sdef = sdef;
+        site->ic_idx = idx;
+    }
+    return idx;
+}
+
+static
+tlisp_obj_t *get_struct_field(tlisp_obj_t *structobj, tlisp_obj_t *args, env_t *env)
+{
+    assert_nargs(1, args, env->proc);
+    return structobj->structobj.fields[struct_field_index(args, structobj, env->proc)];
+}
+
+// Special forms are builtins like any other, but eval dispatches on
+// them directly where the pass over an expression has found one.
+#define SPECIAL_FORMS(X)                        \
+    X(SPECIAL_QUOTE, tlisp_quote_fn)            \
+    X(SPECIAL_BACKQUOTE, tlisp_backquote_fn)    \
+    X(SPECIAL_IF, tlisp_if)                     \
+    X(SPECIAL_WHILE, tlisp_while)               \
+    X(SPECIAL_DO, tlisp_do)                     \
+    X(SPECIAL_LET, tlisp_let)                   \
+    X(SPECIAL_DEF, tlisp_def)                   \
+    X(SPECIAL_SET, tlisp_set)                   \
+    X(SPECIAL_LAMBDA, tlisp_lambda)             \
+    X(SPECIAL_MACRO, tlisp_macro)
+
+#define SPECIAL_ENUM(form, fn) form,
+enum special_form_t {
+    SPECIAL_NONE,
+    SPECIAL_FORMS(SPECIAL_ENUM)
+    NSPECIALS
+};
+
+#define SPECIAL_FN(form, fn) fn,
+static tlisp_fn special_fns[] = { NULL, SPECIAL_FORMS(SPECIAL_FN) };
+
+#define SPECIAL_CASE(form, fn) case form: return fn(args, env);
+
+// The special form form is marked as, or SPECIAL_NONE. Scoping is
+// dynamic, so the mark only holds while no frame binds the name and
+// it's still globally bound to the builtin.
+static
+int special_form(tlisp_obj_t *form, env_t *env)
+{
+    tlisp_obj_t *fn;
+    int special;
+
+    if (IS_COMPACT(form) || !SLOT_IS_SPECIAL(form->ic_idx)) {
+        return SPECIAL_NONE;
+    }
+    special = SLOT_SPECIAL_FORM(form->ic_idx);
+    if (special >= NSPECIALS || form->car->sym_frames) {
+        return SPECIAL_NONE;
+    }
+    fn = env_find(env, form->car);
+    if (!fn || OBJ_TAG(fn) != NFUNC || fn->fn != special_fns[special]) {
+        return SPECIAL_NONE;
+    }
+    return special;
+}
+
+static
+tlisp_obj_t *eval_special(int special, tlisp_obj_t *form, env_t *env)
+{
+    tlisp_obj_t *args = form->cdr;
+
+    switch (special) {
+    SPECIAL_FORMS(SPECIAL_CASE)
+    }
+    return tlisp_apply(form, env);
 }
 
 tlisp_obj_t *eval(tlisp_obj_t *obj, env_t *env)
 {
-    switch (obj->tag) {
+    int special;
+
+    switch (OBJ_TAG(obj)) {
     case BOOL:
     case NUM:
+    case FLOAT:
     case STRING:
     case NIL:
         return obj;
     case SYMBOL: {
-        tlisp_obj_t *o = env_find(env, obj->sym);
+        tlisp_obj_t *o = env_find(env, obj);
         if (!o) {
             char errstr[256];
             snprintf(errstr, 256, "ERROR: Undefined symbol '%s'.\n", obj->sym);
@@ -242,10 +416,14 @@ tlisp_obj_t *eval(tlisp_obj_t *obj, env_t *env)
         return o;
     }
     case CONS:
+        special = special_form(obj, env);
+        if (special) {
+            return eval_special(special, obj, env);
+        }
         return tlisp_apply(obj, env);
     default:
         fprintf(stderr, "Internal error. Eval called on inappropriate type %s.\n",
-                tag_str(obj->tag));
+                tag_str(OBJ_TAG(obj)));
         exit(1);
     }
 }
@@ -253,51 +431,49 @@ tlisp_obj_t *eval(tlisp_obj_t *obj, env_t *env)
 tlisp_obj_t *tlisp_eval(tlisp_obj_t *args, env_t *env)
 {
     assert_nargs(1, args, env->proc);
-    if (args->car->tag == CONS &&
+    if (OBJ_TAG(args->car) == CONS &&
         (args->car->car == tlisp_quote
          || args->car->car == tlisp_backquote)) {
         return eval(args->car->cdr, env);
     }
-    return eval(args->car, env);
+    return eval_car(args, env);
 }
 
-tlisp_obj_t *tlisp_apply(tlisp_obj_t *args, env_t *env)
+tlisp_obj_t *apply_obj(tlisp_obj_t *fn, tlisp_obj_t *fn_args, env_t *env)
 {
-    tlisp_obj_t *fn;
-    tlisp_obj_t *fn_args;
-    tlisp_obj_t *res = NULL;
-
-    if (!args) {
-        proc_fatal(env->proc, "ERROR: apply requires at least one argument.\n");
-    }
-
-    fn = eval(args->car, env);
-    fn_args = args->cdr;
-    switch (fn->tag) {
+    switch (OBJ_TAG(fn)) {
     case NFUNC:
-    case LAMBDA: {
-        res = apply_fn(fn, fn_args, env);
-        break;
-    }
-    case MACRO: {
-        res = apply_macro(fn, fn_args, env);
-        break;
-    }
-    case STRUCTDEF: {
-        res = create_struct(fn, fn_args, env);
-        break;
-    }
-    case STRUCT: {
-        res = get_struct_field(fn, fn_args, env);
-        break;
-    }
+    case LAMBDA:
+        return apply_fn(fn, fn_args, env);
+    case MACRO:
+        return apply_macro(fn, fn_args, env);
+    case STRUCTDEF:
+        return create_struct(fn, fn_args, env);
+    case STRUCT:
+        return get_struct_field(fn, fn_args, env);
     default: {
         char errstr[256];
         snprintf(errstr, 256, "ERROR: apply cannot be called on object of type %s.\n",
-                 tag_str(fn->tag));
+                 tag_str(OBJ_TAG(fn)));
         proc_fatal(env->proc, errstr);
+        return NULL;
     }
     }
+}
+
+tlisp_obj_t *tlisp_apply(tlisp_obj_t *args, env_t *env)
+{
+    tlisp_obj_t *fn;
+    tlisp_obj_t *res;
+
+    if (!args) {
+        proc_fatal(env->proc, "ERROR: apply requires at least one argument.\n");
+    }
+
+    fn = eval_car(args, env);
+    proc_push_root(env->proc, &fn);
+    res = apply_obj(fn, args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     return res;
 }
 
@@ -314,34 +490,39 @@ tlisp_obj_t *tlisp_backquote_fn(tlisp_obj_t *args, env_t *env)
 
     tlisp_obj_t *head = NULL;
     tlisp_obj_t *curr;
-    tlisp_obj_t *next;
+    tlisp_obj_t *next = NULL;
 
     if (!args) {
         proc_fatal(env->proc, "ERROR: backquote requires at least one argument.\n");
     }
+    proc_push_root(env->proc, &head);
+    proc_push_root(env->proc, &next);
     while (args) {
         assert_type(args, CONS, env->proc);
         next = proc_new_cons(env->proc);
-        if (args->car->tag == SYMBOL && args->car->sym[0] == '~') {
-            next->car = env_find(env, args->car->sym + 1);
+        if (OBJ_TAG(args->car) == SYMBOL && args->car->sym[0] == '~') {
+            next->car = env_find(env, intern(args->car->sym + 1, strlen(args->car->sym + 1)));
             if (!next->car) {
                 char errstr[256];
-                snprintf(errstr, 256, "ERROR: Unable to expand symbol %s\n", args->sym);
+                snprintf(errstr, 256, "ERROR: Unable to expand symbol %s\n", args->car->sym);
                 proc_fatal(env->proc, errstr);
             }
-        } else if (args->car->tag == CONS) {
+        } else if (OBJ_TAG(args->car) == CONS) {
             next->car = tlisp_backquote_fn(args->car, env); 
         } else {
             next->car = args->car;
         }
+        gc_write_barrier(env->proc, next, next->car);
         if (head) {
             curr->cdr = next;
+            gc_write_barrier(env->proc, curr, next);
         } else {
             head = next;
         }
         curr = next;
         args = args->cdr;
     }
+    proc_pop_roots(env->proc, 2);
     return head;
 }
 
@@ -349,12 +530,14 @@ tlisp_obj_t *tlisp_type_of(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *res;
     tlisp_obj_t *arg;
+    const char *name;
     
     assert_nargs(1, args, env->proc);
-    arg = eval(args->car, env);
-    res = proc_new_str(env->proc);
-    res->str = arg->tag == STRUCT ?
-        strdup(arg->structobj.sdef->name) : strdup(tag_str(arg->tag));
+    arg = eval_car(args, env);
+    proc_push_root(env->proc, &arg);
+    name = OBJ_TAG(arg) == STRUCT ? arg->structobj.sdef->name : tag_str(OBJ_TAG(arg));
+    res = proc_new_str(env->proc, pool_strdup(name), strlen(name));
+    proc_pop_roots(env->proc, 1);
     return res;
 }
 
@@ -369,7 +552,6 @@ tlisp_obj_t *tlisp_let(tlisp_obj_t *args, env_t *env)
     bindings = arg_at(0, args);
     while (bindings) {
         tlisp_obj_t *sym = bindings->car;
-        tlisp_obj_t *expr;
 
         assert_type(sym, SYMBOL, env->proc);
         bindings = bindings->cdr;
@@ -379,11 +561,10 @@ tlisp_obj_t *tlisp_let(tlisp_obj_t *args, env_t *env)
                      "ERROR: No matching binding for %s.\n", sym->sym);
             proc_fatal(env->proc, errstr);
         }
-        expr = bindings->car;
-        env_add(&inner_env, sym->sym, eval(expr, env));
+        env_add(&inner_env, sym, eval_car(bindings, env));
         bindings = bindings->cdr;
     }
-    eval(arg_at(1, args), &inner_env);
+    eval_car(args->cdr, &inner_env);
     env_destroy(&inner_env);
     return tlisp_nil;
 }
@@ -393,7 +574,7 @@ tlisp_obj_t *tlisp_do(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
     
     while (args) {
-        res = eval(args->car, env);
+        res = eval_car(args, env);
         args = args->cdr;
     }
     return res ? res : tlisp_nil;
@@ -406,26 +587,20 @@ tlisp_obj_t *tlisp_if(tlisp_obj_t *args, env_t *env)
     if (len != 2 && len != 3) {
         proc_fatal(env->proc, "ERROR: Invalid if expression.\n");
     }
-    if (is_true(eval(arg_at(0, args), env))) {
-        return eval(arg_at(1, args), env);
+    if (is_true(eval_car(args, env))) {
+        return eval_car(args->cdr, env);
     }
     if (len == 3) {
-        return eval(arg_at(2, args), env);
+        return eval_car(args->cdr->cdr, env);
     }
     return tlisp_nil;
 }
 
 tlisp_obj_t *tlisp_while(tlisp_obj_t *args, env_t *env)
 {
-    tlisp_obj_t *cond;
-    tlisp_obj_t *body;
-
     assert_nargs(2, args, env->proc);
-    cond = arg_at(0, args);
-    body = arg_at(1, args);
-
-    while (is_true(eval(cond, env))) {
-        eval(body, env);
+    while (is_true(eval_car(args, env))) {
+        eval_car(args->cdr, env);
     }
     return tlisp_nil;
 }
@@ -437,11 +612,10 @@ tlisp_obj_t *tlisp_def(tlisp_obj_t *args, env_t *env)
     
     assert_nargs(2, args, env->proc);
     sym = arg_at(0, args);
-    val = arg_at(1, args);
     assert_type(sym, SYMBOL, env->proc);
 
-    val = eval(val, env);
-    env_add(env, sym->sym, val);
+    val = eval_car(args->cdr, env);
+    env_add(env, sym, val);
     return val;
 }
 
@@ -452,9 +626,9 @@ tlisp_obj_t *tlisp_set(tlisp_obj_t *args, env_t *env)
 
     assert_nargs(2, args, env->proc);
     sym = arg_at(0, args);
-    val = eval(arg_at(1, args), env);
+    val = eval_car(args->cdr, env);
     assert_type(sym, SYMBOL, env->proc);
-    if (!env_update(env, sym->sym, val)) {
+    if (!env_update(env, sym, val)) {
         char errstr[128];
         snprintf(errstr, 128, "ERROR: No previous value for symbol %s.\n", sym->sym);
         proc_fatal(env->proc, errstr);
@@ -479,45 +653,161 @@ tlisp_obj_t *tlisp_defstruct(tlisp_obj_t *args, env_t *env)
     assert_type(name, SYMBOL, env->proc);
     
     obj = proc_new_structdef(env->proc);
-    obj->structdef.name = strdup(name->sym);
-    obj->structdef.nfields = nfields;
-    obj->structdef.field_names = malloc(sizeof(char *) * nfields);
+    structdef_init(&obj->structdef, name->sym, nfields);
     while (fields) {
         tlisp_obj_t *curr = fields->car;
         assert_type(curr, SYMBOL, env->proc);
-        obj->structdef.field_names[currfield] = strdup(curr->sym);
+        obj->structdef.field_names[currfield] = curr->sym;
         fields = fields->cdr;
         currfield++;
     }
-    env_add(env, name->sym, obj);
+    structdef_index(&obj->structdef);
+    env_add(env, name, obj);
     return obj;
 }
 
 tlisp_obj_t *tlisp_setq(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *structobj;
-    tlisp_obj_t *field;
     tlisp_obj_t *newval;
+    int idx;
 
     assert_nargs(3, args, env->proc);
-    structobj = eval(arg_at(0, args), env);
-    field = arg_at(1, args);
-    newval = eval(arg_at(2, args), env);
+    structobj = eval_car(args, env);
+    proc_push_root(env->proc, &structobj);
+    newval = eval_car(args->cdr->cdr, env);
+    proc_pop_roots(env->proc, 1);
     assert_type(structobj, STRUCT, env->proc);
-    assert_type(field, SYMBOL, env->proc);
-    if (!struct_setq(&structobj->structobj, field->sym, newval)) {
-        char errstr[256];
-        char objstr[128];
-        snprintf(errstr, 256, "ERROR: No field %s for struct %s.\n",
-                 field->sym, obj_nstr(structobj, objstr, 128));
-        proc_fatal(env->proc, errstr);
-    }
+    idx = struct_field_index(args->cdr, structobj, env->proc);
+    structobj->structobj.fields[idx] = newval;
+    gc_write_barrier(env->proc, structobj, newval);
     return structobj; 
 }
 
+// The resolver marks each cons whose car is a local variable with the
+// slot it's bound in, so that eval_car can load it straight from
+// there. It follows the special forms to see which names code is in
+// scope of, looking their heads up in env when the resolving is done.
+// Anything it gets wrong only costs a fallback to env_find, since
+// every slot is checked before it's used.
+static void resolve_site(tlisp_obj_t *, scope_t *, env_t *);
+
+static
+void resolve_args(tlisp_obj_t *args, scope_t *scope, env_t *env)
+{
+    for (; args && OBJ_TAG(args) == CONS; args = args->cdr) {
+        resolve_site(args, scope, env);
+    }
+}
+
+static
+void resolve_let(tlisp_obj_t *args, scope_t *scope, env_t *env)
+{
+    tlisp_obj_t *bindings;
+    scope_t inner;
+
+    if (!args || OBJ_TAG(args->car) != CONS || !args->cdr) {
+        return;
+    }
+    for (bindings = args->car; bindings; bindings = bindings->cdr->cdr) {
+        if (OBJ_TAG(bindings) != CONS || OBJ_TAG(bindings->car) != SYMBOL
+            || !bindings->cdr || OBJ_TAG(bindings->cdr) != CONS) {
+            return;
+        }
+    }
+    for (bindings = args->car; bindings; bindings = bindings->cdr->cdr) {
+        resolve_site(bindings->cdr, scope, env);
+    }
+    inner.names = args->car;
+    inner.step = 2;
+    inner.outer = scope;
+    resolve_args(args->cdr, &inner, env);
+}
+
+static
+void resolve_form(tlisp_obj_t *form, scope_t *scope, env_t *env)
+{
+    tlisp_obj_t *head = form->car;
+    tlisp_obj_t *args = form->cdr;
+    tlisp_obj_t *callee = NULL;
+    scope_t inner;
+
+    resolve_site(form, scope, env);
+    if (OBJ_TAG(head) == SYMBOL && !scope_find(scope, head)) {
+        callee = env_find(env, head);
+    }
+    if (callee && OBJ_TAG(callee) == NFUNC) {
+        tlisp_fn fn = callee->fn;
+        int special;
+
+        for (special = SPECIAL_NONE + 1; special < NSPECIALS; special++) {
+            if (fn == special_fns[special] && !IS_COMPACT(form)) {
+                form->ic_sdef = NULL;
+                form->ic_idx = SLOT_SPECIAL(special);
+                break;
+            }
+        }
+
+        // A nested lambda's body runs in frames of its callers'
+        // making, and is resolved once the lambda is made.
+        if (fn == tlisp_quote_fn || fn == tlisp_backquote_fn || fn == tlisp_lambda
+            || fn == tlisp_macro || fn == tlisp_defstruct) {
+            return;
+        }
+        if (fn == tlisp_let) {
+            resolve_let(args, scope, env);
+        } else if ((fn == tlisp_def || fn == tlisp_set) && args && OBJ_TAG(args) == CONS) {
+            resolve_args(args->cdr, scope, env);
+        } else {
+            resolve_args(args, scope, env);
+        }
+        return;
+    }
+
+    // A lambda's arguments are evaluated in its new frame, so the
+    // names they see are a frame further out.
+    inner.names = NULL;
+    inner.step = 1;
+    inner.outer = scope;
+    resolve_args(args, callee && OBJ_TAG(callee) != LAMBDA ? scope : &inner, env);
+}
+
+static
+void resolve_site(tlisp_obj_t *site, scope_t *scope, env_t *env)
+{
+    tlisp_obj_t *expr = site->car;
+    int slot;
+
+    if (!expr || IS_COMPACT(site)) {
+        return;
+    }
+    switch (OBJ_TAG(expr)) {
+    case SYMBOL:
+        slot = scope_find(scope, expr);
+        if (slot) {
+            site->ic_sdef = NULL;
+            site->ic_idx = slot;
+        }
+        return;
+    case CONS:
+        resolve_form(expr, scope, env);
+        return;
+    default:
+        return;
+    }
+}
+
+void resolve_locals(tlisp_obj_t *expr, env_t *env)
+{
+    if (expr && OBJ_TAG(expr) == CONS && !IS_COMPACT(expr)) {
+        resolve_form(expr, NULL, env);
+    }
+}
+
 tlisp_obj_t *tlisp_lambda(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *res = proc_new_lambda(env->proc);
+    tlisp_obj_t *params;
     
     if (!args || !args->cdr) {
         proc_fatal(env->proc, "ERROR: lambda requires at least two arguments.\n");
@@ -525,10 +815,26 @@ tlisp_obj_t *tlisp_lambda(tlisp_obj_t *args, env_t *env)
     assert_type(args->car, CONS, env->proc);
     res->car = args->car;
     res->cdr = args->cdr;
-    args = args->car;
-    while (args) {
-        assert_type(args->car, SYMBOL, env->proc);
-        args = args->cdr;
+    res->code = NULL;
+    gc_write_barrier(env->proc, res, res->car);
+    gc_write_barrier(env->proc, res, res->cdr);
+    params = args->car;
+    while (params) {
+        assert_type(params->car, SYMBOL, env->proc);
+        params = params->cdr;
+    }
+
+    // The body only needs resolving once. The cons holding the
+    // parameter list is never a variable's site, so its ic_idx
+    // marks that it's been done.
+    if (!IS_COMPACT(args) && !args->ic_idx) {
+        scope_t scope;
+
+        scope.names = res->car;
+        scope.step = 1;
+        scope.outer = NULL;
+        resolve_args(res->cdr, &scope, env);
+        args->ic_idx = 1;
     }
     return res;
 }
@@ -541,6 +847,8 @@ tlisp_obj_t *tlisp_macro(tlisp_obj_t *args, env_t *env)
     assert_type(args->car, CONS, env->proc);
     res->car = args->car;
     res->cdr = args->cdr;
+    gc_write_barrier(env->proc, res, res->car);
+    gc_write_barrier(env->proc, res, res->cdr);
     args = args->car;
     while (args) {
         assert_type(args->car, SYMBOL, env->proc);
@@ -555,8 +863,12 @@ tlisp_obj_t *tlisp_cons(tlisp_obj_t *args, env_t *env)
 
     assert_nargs(2, args, env->proc);
     res = proc_new_cons(env->proc);
-    res->car = eval(args->car, env);
-    res->cdr = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &res);
+    res->car = eval_car(args, env);
+    gc_write_barrier(env->proc, res, res->car);
+    res->cdr = eval_car(args->cdr, env);
+    gc_write_barrier(env->proc, res, res->cdr);
+    proc_pop_roots(env->proc, 1);
     if (res->cdr == tlisp_nil) {
         res->cdr = NULL;
         return res;
@@ -572,8 +884,11 @@ tlisp_obj_t *tlisp_append(tlisp_obj_t *args, env_t *env)
 
     assert_nargs(2, args, env->proc);
     res = proc_new_cons(env->proc);
-    res->car = eval(args->car, env);
-    head = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &res);
+    res->car = eval_car(args, env);
+    gc_write_barrier(env->proc, res, res->car);
+    head = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     if (head == tlisp_nil) {
         return res;
     }
@@ -582,66 +897,103 @@ tlisp_obj_t *tlisp_append(tlisp_obj_t *args, env_t *env)
         args = args->cdr;
     }
     args->cdr = res;
+    gc_write_barrier(env->proc, head, res);
     return head;
 }
 
-tlisp_obj_t *tlisp_car(tlisp_obj_t *args, env_t *env)
+tlisp_obj_t *car_of(tlisp_obj_t *list, process_t *proc)
 {
-    tlisp_obj_t *list;
-
-    assert_nargs(1, args, env->proc);
-    list = eval(args->car, env);
     if (list == tlisp_nil)  {
         return tlisp_nil;
     }
-    assert_type(list, CONS, env->proc);
+    assert_type(list, CONS, proc);
     return list->car;
 }
 
-tlisp_obj_t *tlisp_cdr(tlisp_obj_t *args, env_t *env)
+tlisp_obj_t *tlisp_car(tlisp_obj_t *args, env_t *env)
 {
-    tlisp_obj_t *list;
-
     assert_nargs(1, args, env->proc);
-    list = eval(args->car, env);
-    assert_type(list, CONS, env->proc);
+    return car_of(eval_car(args, env), env->proc);
+}
+
+tlisp_obj_t *cdr_of(tlisp_obj_t *list, process_t *proc)
+{
+    assert_type(list, CONS, proc);
     return list->cdr ? list->cdr : tlisp_nil;
 }
 
+tlisp_obj_t *tlisp_cdr(tlisp_obj_t *args, env_t *env)
+{
+    assert_nargs(1, args, env->proc);
+    return cdr_of(eval_car(args, env), env->proc);
+}
+
 tlisp_obj_t *tlisp_print(tlisp_obj_t *args, env_t *env)
 {
     while (args) {
         char str[1024];
         tlisp_obj_t *curr;
 
-        curr = eval(args->car, env);
-        obj_nstr(curr, str, 1024);
-        printf("%s\n", str);
+        curr = eval_car(args, env);
+        if (OBJ_TAG(curr) == STRING) {
+            fwrite(curr->str, 1, curr->str_len, stdout);
+            putchar('\n');
+        } else {
+            obj_nstr(curr, str, 1024);
+            printf("%s\n", str);
+        }
         args = args->cdr;
     }
     return tlisp_nil;
 }
 
-tlisp_obj_t *tlisp_str(tlisp_obj_t *args, env_t *env)
+// Appends obj's text to sb. Strings and builders are copied whole;
+// anything else is appended in its printed form.
+static
+void strbuf_append_obj(tlisp_strbuf_t *sb, tlisp_obj_t *obj)
 {
-    char arg_strs[1024];
-    tlisp_obj_t *res = proc_new_str(env->proc);
-    int res_len = 0;
+    char str[1024];
 
-    if (!args) {
-        res->str = strdup("");
-        return res;
+    switch (OBJ_TAG(obj)) {
+    case STRING:
+        strbuf_append(sb, obj->str, obj->str_len);
+        break;
+    case STRBUILDER:
+        strbuf_append(sb, obj->strbuf.buf, obj->strbuf.len);
+        break;
+    default:
+        obj_nstr(obj, str, 1024);
+        strbuf_append(sb, str, strlen(str));
+        break;
     }
+}
+
+tlisp_obj_t *tlisp_str(tlisp_obj_t *args, env_t *env)
+{
+    tlisp_strbuf_t sb;
+    tlisp_obj_t *curr;
+    size_t len;
+
+    strbuf_init(&sb);
     while (args) {
-        tlisp_obj_t *curr = eval(args->car, env);
-        obj_nstr(curr, arg_strs + res_len, 1024 - res_len - 1);
-        res_len += strlen(arg_strs + res_len);
+        curr = eval_car(args, env);
+        // A lone builder hands its buffer to the new string
+        // without a copy, leaving the builder empty.
+        if (OBJ_TAG(curr) == STRBUILDER && !args->cdr && !sb.len) {
+            len = curr->strbuf.len;
+            return proc_new_str(env->proc, strbuf_take(&curr->strbuf), len);
+        }
+        strbuf_append_obj(&sb, curr);
         args = args->cdr;
     }
-    arg_strs[res_len++] = 0;
-    res->str = malloc(sizeof(char) * res_len);
-    strcpy(res->str, arg_strs);
-    return res;
+    len = sb.len;
+    return proc_new_str(env->proc, strbuf_take(&sb), len);
+}
+
+tlisp_obj_t *tlisp_string_builder(tlisp_obj_t *args, env_t *env)
+{
+    assert_nargs(0, args, env->proc);
+    return proc_new_strbuilder(env->proc);
 }
 
 tlisp_obj_t *tlisp_list(tlisp_obj_t *args, env_t *env)
@@ -653,24 +1005,32 @@ tlisp_obj_t *tlisp_list(tlisp_obj_t *args, env_t *env)
         return tlisp_nil;
     }
     head = proc_new_cons(env->proc);
-    head->car = eval(args->car, env);
+    proc_push_root(env->proc, &head);
+    head->car = eval_car(args, env);
+    gc_write_barrier(env->proc, head, head->car);
     curr = head;
     while ((args = args->cdr)) {
         curr->cdr = proc_new_cons(env->proc);
+        gc_write_barrier(env->proc, curr, curr->cdr);
         curr = curr->cdr;
-        curr->car = eval(args->car, env);
+        curr->car = eval_car(args, env);
+        gc_write_barrier(env->proc, curr, curr->car);
     }
+    proc_pop_roots(env->proc, 1);
     return head;
 }
 
 tlisp_obj_t *tlisp_dict(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *dict = proc_new_dict(env->proc);
+    tlisp_obj_t *key = NULL;
 
+    proc_push_root(env->proc, &dict);
+    proc_push_root(env->proc, &key);
     while (args) {
-        tlisp_obj_t *key = eval(args->car, env);
         tlisp_obj_t *val;
 
+        key = eval_car(args, env);
         if (!args->cdr) {
             char errstr[256];
             char objstr[128];
@@ -679,10 +1039,13 @@ tlisp_obj_t *tlisp_dict(tlisp_obj_t *args, env_t *env)
             proc_fatal(env->proc, errstr);
         }
         args = args->cdr;
-        val = eval(args->car, env);
+        val = eval_car(args, env);
         dict_ins(&dict->dict, key, val);
+        gc_write_barrier(env->proc, dict, key);
+        gc_write_barrier(env->proc, dict, val);
         args = args->cdr;
     }
+    proc_pop_roots(env->proc, 2);
     return dict;
 }
 
@@ -690,67 +1053,90 @@ tlisp_obj_t *tlisp_vec(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *vec = proc_new_vec(env->proc);
 
+    proc_push_root(env->proc, &vec);
     while (args) {
-        tlisp_obj_t *elem = eval(args->car, env);
+        tlisp_obj_t *elem = eval_car(args, env);
         vec_ins(&vec->vec, elem);
+        gc_write_barrier(env->proc, vec, elem);
         args = args->cdr;
     }
+    proc_pop_roots(env->proc, 1);
     return vec;
 }
 
 tlisp_obj_t *tlisp_ins(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *coll;
+    tlisp_obj_t *tmp = NULL;
     tlisp_obj_t *res = NULL;
 
     if (!args) {
         proc_fatal(env->proc, "ERROR: ins requires at least one argument.\n");
     }
-    coll = eval(arg_at(0, args), env);
-    switch (coll->tag) {
+    coll = eval_car(args, env);
+    proc_push_root(env->proc, &coll);
+    proc_push_root(env->proc, &tmp);
+    switch (OBJ_TAG(coll)) {
     case NIL: {
         assert_nargs(2, args, env->proc);
-        res = proc_new_cons(env->proc);
-        res->car = eval(arg_at(1, args), env);
+        tmp = proc_new_cons(env->proc);
+        tmp->car = eval_car(args->cdr, env);
+        gc_write_barrier(env->proc, tmp, tmp->car);
+        res = tmp;
         break;
     }
     case CONS: {
         while ((args = args->cdr)) {
-            tlisp_obj_t *cell = proc_new_cons(env->proc);
-            cell->car = eval(args->car, env);
-            coll = list_ins(coll, cell);
+            tmp = proc_new_cons(env->proc);
+            tmp->car = eval_car(args, env);
+            gc_write_barrier(env->proc, tmp, tmp->car);
+            coll = list_ins(coll, tmp);
+            gc_write_barrier(env->proc, tmp, tmp->cdr);
         }
         res = coll;
         break;
     }
     case DICT: {
         while ((args = args->cdr)) {
-            tlisp_obj_t *key = eval(args->car, env);
             tlisp_obj_t *val;
 
+            tmp = eval_car(args, env);
             args = args->cdr;
             if (!args) {
                 proc_fatal(env->proc, "ERROR: Missing matching value.\n");
             }
-            val = eval(args->car, env);
-            res = dict_ins(&coll->dict, key, val);
+            val = eval_car(args, env);
+            res = dict_ins(&coll->dict, tmp, val);
+            gc_write_barrier(env->proc, coll, tmp);
+            gc_write_barrier(env->proc, coll, val);
         }
         res = res ? res : tlisp_nil;
         break;
     }
     case VEC: {
         while ((args = args->cdr)) {
-            vec_ins(&coll->vec, eval(args->car, env));
+            tmp = eval_car(args, env);
+            vec_ins(&coll->vec, tmp);
+            gc_write_barrier(env->proc, coll, tmp);
         }
         res = tlisp_nil;
         break;
     }
+    case STRBUILDER: {
+        while ((args = args->cdr)) {
+            tmp = eval_car(args, env);
+            strbuf_append_obj(&coll->strbuf, tmp);
+        }
+        res = coll;
+        break;
+    }
     default: {
         char errstr[128];
-        snprintf(errstr, 128, "ERROR: Wrong arg type to len: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to len: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
+    proc_pop_roots(env->proc, 2);
     return res;
 }
 
@@ -762,11 +1148,14 @@ tlisp_obj_t *tlisp_ins_at(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
 
     assert_nargs(3, args, env->proc);
-    coll = eval(arg_at(0, args), env);
-    obj = eval(arg_at(1, args), env);
-    idx = eval(arg_at(2, args), env);
+    coll = eval_car(args, env);
+    proc_push_root(env->proc, &coll);
+    obj = eval_car(args->cdr, env);
+    proc_push_root(env->proc, &obj);
+    idx = eval_car(args->cdr->cdr, env);
+    proc_push_root(env->proc, &idx);
     assert_type(idx, NUM, env->proc);
-    switch (coll->tag) {
+    switch (OBJ_TAG(coll)) {
     case NIL: {
         res = tlisp_nil;
         break;
@@ -774,20 +1163,24 @@ tlisp_obj_t *tlisp_ins_at(tlisp_obj_t *args, env_t *env)
     case CONS: {
         tlisp_obj_t *cell = proc_new_cons(env->proc);
         cell->car = obj;
-        res = list_ins_at(coll, cell, idx->num);
+        gc_write_barrier(env->proc, cell, obj);
+        res = list_ins_at(coll, cell, NUM_VAL(idx), env->proc);
+        gc_write_barrier(env->proc, cell, cell->cdr);
         break;
     }
     case VEC: {
-        res = tlisp_bool(vec_ins_at(&coll->vec, obj, idx->num));
+        res = tlisp_bool(vec_ins_at(&coll->vec, obj, NUM_VAL(idx)));
+        gc_write_barrier(env->proc, coll, obj);
         break;
     }
     default: {
         char errstr[128];
         print_obj(coll);
-        snprintf(errstr, 128, "ERROR: Wrong arg type to ins-at: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to ins-at: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
+    proc_pop_roots(env->proc, 3);
     return res;
 }
 
@@ -798,16 +1191,18 @@ tlisp_obj_t *tlisp_get(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
 
     assert_nargs(2, args, env->proc);
-    coll = eval(arg_at(0, args), env);
-    key = eval(arg_at(1, args), env);
-    switch (coll->tag) {
+    coll = eval_car(args, env);
+    proc_push_root(env->proc, &coll);
+    key = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
+    switch (OBJ_TAG(coll)) {
     case NIL: {
         res = tlisp_nil;
         break;
     }
     case CONS: {
         assert_type(key, NUM, env->proc);
-        res = list_get(coll, key->num);
+        res = list_get(coll, NUM_VAL(key));
         res = res ? res : tlisp_nil;
         break;
     }
@@ -818,13 +1213,13 @@ tlisp_obj_t *tlisp_get(tlisp_obj_t *args, env_t *env)
     }
     case VEC: {
         assert_type(key, NUM, env->proc);
-        res = vec_get(&coll->vec, key->num);
+        res = vec_get(&coll->vec, NUM_VAL(key));
         res = res ? res : tlisp_nil;
         break;
     }
     default: {
         char errstr[128];
-        snprintf(errstr, 128, "ERROR: Wrong arg type to get: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to get: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
@@ -838,30 +1233,34 @@ tlisp_obj_t *tlisp_rem(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
 
     assert_nargs(2, args, env->proc);
-    coll = eval(arg_at(0, args), env);
-    key = eval(arg_at(1, args), env);
-    switch (coll->tag) {
+    coll = eval_car(args, env);
+    proc_push_root(env->proc, &coll);
+    key = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
+    switch (OBJ_TAG(coll)) {
     case NIL: {
         res = tlisp_nil;
         break;
     }
     case CONS: {
-        res = list_rem(coll, key);
+        res = list_rem(coll, key, env->proc);
         res = res ? res : tlisp_nil;
         break;
     }
     case DICT: {
         res = dict_rem(&coll->dict, key);
         res = res ? res : tlisp_nil;
+        gc_write_barrier(env->proc, coll, NULL);
         break;
     }        
     case VEC: {
         res = tlisp_bool(vec_rem(&coll->vec, key));
+        gc_write_barrier(env->proc, coll, NULL);
         break;
     }
     default: {
         char errstr[128];
-        snprintf(errstr, 128, "ERROR: Wrong arg type to get: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to get: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
@@ -875,27 +1274,30 @@ tlisp_obj_t *tlisp_rem_at(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
 
     assert_nargs(2, args, env->proc);
-    coll = eval(arg_at(0, args), env);
-    idx = eval(arg_at(1, args), env);
+    coll = eval_car(args, env);
+    proc_push_root(env->proc, &coll);
+    idx = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     assert_type(idx, NUM, env->proc);
-    switch (coll->tag) {
+    switch (OBJ_TAG(coll)) {
     case NIL: {
         res = tlisp_nil;
         break;
     }
     case CONS: {
-        res = list_rem_at(coll, idx->num);
+        res = list_rem_at(coll, NUM_VAL(idx), env->proc);
         res = res ? res : tlisp_nil;
         break;
     }
     case VEC: {
-        res = vec_rem_at(&coll->vec, idx->num);
+        res = vec_rem_at(&coll->vec, NUM_VAL(idx));
         res = res ? res : tlisp_nil;
+        gc_write_barrier(env->proc, coll, NULL);
         break;
     }
     default: {
         char errstr[128];
-        snprintf(errstr, 128, "ERROR: Wrong arg type to rem-at: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to rem-at: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
@@ -905,35 +1307,42 @@ tlisp_obj_t *tlisp_rem_at(tlisp_obj_t *args, env_t *env)
 tlisp_obj_t *tlisp_len(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *coll;
-    tlisp_obj_t *res = NULL;
+    int64_t len = 0;
 
     assert_nargs(1, args, env->proc);
-    coll = eval(args->car, env);
-    res = proc_new_num(env->proc);
-    switch (coll->tag) {
+    coll = eval_car(args, env);
+    switch (OBJ_TAG(coll)) {
     case NIL: {
-        res->num = 0;
+        len = 0;
         break;
     }
     case CONS: {
-        res->num = list_len(coll);
+        len = list_len(coll);
         break;
     }
     case DICT: {
-        res->num = dict_len(&coll->dict);
+        len = dict_len(&coll->dict);
         break;
     }
     case VEC: {
-        res->num = vec_len(&coll->vec);
+        len = vec_len(&coll->vec);
+        break;
+    }
+    case STRING: {
+        len = coll->str_len;
+        break;
+    }
+    case STRBUILDER: {
+        len = coll->strbuf.len;
         break;
     }
     default: {
         char errstr[128];
-        snprintf(errstr, 128, "ERROR: Wrong arg type to len: %s.\n", tag_str(coll->tag));
+        snprintf(errstr, 128, "ERROR: Wrong arg type to len: %s.\n", tag_str(OBJ_TAG(coll)));
         proc_fatal(env->proc, errstr);
     }
     }
-    return res;
+    return FIXNUM(len);
 }
 
 tlisp_obj_t *tlisp_for_each(tlisp_obj_t *args, env_t *env)
@@ -942,17 +1351,20 @@ tlisp_obj_t *tlisp_for_each(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *fn;
 
     assert_nargs(2, args, env->proc);
-    list = eval(args->car, env);
+    list = eval_car(args, env);
     if (list == tlisp_nil) {
         return 0;
     }
     assert_type(list, CONS, env->proc);
-    fn = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &list);
+    fn = eval_car(args->cdr, env);
+    proc_push_root(env->proc, &fn);
     assert_fn(fn, env->proc);
     while (list) {
         apply_1arity_fn(fn, list->car, env);
         list = list->cdr;
     }
+    proc_pop_roots(env->proc, 2);
     return tlisp_nil;
 }
 
@@ -964,21 +1376,28 @@ tlisp_obj_t *tlisp_map(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *curr;
 
     assert_nargs(2, args, env->proc);
-    list = eval(args->car, env);
+    list = eval_car(args, env);
     if (list == tlisp_nil) {
         return tlisp_nil;
     }
     assert_type(list, CONS, env->proc);
-    fn = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &list);
+    fn = eval_car(args->cdr, env);
+    proc_push_root(env->proc, &fn);
     assert_fn(fn, env->proc);
     res = proc_new_cons(env->proc);
+    proc_push_root(env->proc, &res);
     res->car = apply_1arity_fn(fn, list->car, env);
+    gc_write_barrier(env->proc, res, res->car);
     curr = res;
     while ((list = list->cdr)) {
         curr->cdr = proc_new_cons(env->proc);
+        gc_write_barrier(env->proc, curr, curr->cdr);
         curr = curr->cdr;
         curr->car = apply_1arity_fn(fn, list->car, env);
+        gc_write_barrier(env->proc, curr, curr->car);
     }
+    proc_pop_roots(env->proc, 3);
     return res;
 }
 
@@ -990,12 +1409,15 @@ tlisp_obj_t *tlisp_filter(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *curr;
 
     assert_nargs(2, args, env->proc);
-    list = eval(args->car, env);
+    list = eval_car(args, env);
     if (list == tlisp_nil) {
         return tlisp_nil;
     }
     assert_type(list, CONS, env->proc);
-    fn = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &list);
+    fn = eval_car(args->cdr, env);
+    proc_push_root(env->proc, &fn);
+    proc_push_root(env->proc, &res);
     assert_fn(fn, env->proc);
     while (list) {
         tlisp_obj_t *keep = apply_1arity_fn(fn, list->car, env);
@@ -1003,15 +1425,19 @@ tlisp_obj_t *tlisp_filter(tlisp_obj_t *args, env_t *env)
             if (res == NULL) {
                 res = proc_new_cons(env->proc);
                 res->car = list->car;
+                gc_write_barrier(env->proc, res, res->car);
                 curr = res;
             } else {
                 curr->cdr = proc_new_cons(env->proc);
+                gc_write_barrier(env->proc, curr, curr->cdr);
                 curr = curr->cdr;
                 curr->car = list->car;
+                gc_write_barrier(env->proc, curr, curr->car);
             }
         }
         list = list->cdr;
     }
+    proc_pop_roots(env->proc, 3);
     return res ? res : tlisp_nil;
 }
 
@@ -1022,22 +1448,28 @@ tlisp_obj_t *tlisp_reduce(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res = NULL;
 
     assert_nargs(2, args, env->proc);
-    list = eval(args->car, env);
+    list = eval_car(args, env);
     if (list == tlisp_nil) {
         return tlisp_nil;
     }
     assert_type(list, CONS, env->proc);
-    fn = eval(args->cdr->car, env);
+    proc_push_root(env->proc, &list);
+    fn = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     assert_fn(fn, env->proc);
     if (!list->cdr) {
         return list->car;
     }
+    proc_push_root(env->proc, &list);
+    proc_push_root(env->proc, &fn);
+    proc_push_root(env->proc, &res);
     res = apply_2arity_fn(fn, list->car, list->cdr->car, env);
     list = list->cdr->cdr;
     while (list) {
         res = apply_2arity_fn(fn, res, list->car, env);
         list = list->cdr;
     }
+    proc_pop_roots(env->proc, 3);
     return res;
 }
 
@@ -1048,8 +1480,10 @@ tlisp_obj_t *tlisp_open(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *res;
 
     assert_nargs(2, args, env->proc);
-    fname = eval(arg_at(0, args), env);
-    fmode = eval(arg_at(1, args), env);
+    fname = eval_car(args, env);
+    proc_push_root(env->proc, &fname);
+    fmode = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     assert_type(fname, STRING, env->proc);
     assert_type(fmode, STRING, env->proc);
 
@@ -1061,20 +1495,20 @@ tlisp_obj_t *tlisp_readline(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *fobj;
     FILE *fin;
-    tlisp_obj_t *line;
+    char *buf;
 
     assert_nargs(1, args, env->proc);
-    fobj = eval(arg_at(0, args), env);
+    fobj = eval_car(args, env);
     fin = proc_getf(env->proc, fobj);
     if (!fin) {
         return tlisp_false;
     }
-    line = proc_new_str(env->proc);
-    line->str = malloc(sizeof(char) * 128);
-    if (!fgets(line->str, 128, fin)) {
+    buf = pool_alloc(sizeof(char) * 128);
+    if (!fgets(buf, 128, fin)) {
+        pool_free(buf);
         return tlisp_false;
     }
-    return line;
+    return proc_new_str(env->proc, buf, strlen(buf));
 }
 
 tlisp_obj_t *tlisp_write(tlisp_obj_t *args, env_t *env)
@@ -1084,14 +1518,16 @@ tlisp_obj_t *tlisp_write(tlisp_obj_t *args, env_t *env)
     FILE *fout;
 
     assert_nargs(2, args, env->proc);
-    fobj = eval(arg_at(0, args), env);
-    msg = eval(arg_at(1, args), env);
+    fobj = eval_car(args, env);
+    proc_push_root(env->proc, &fobj);
+    msg = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
     assert_type(msg, STRING, env->proc);
     fout = proc_getf(env->proc, fobj);
     if (!fout) {
         return tlisp_nil;
     }
-    return fputs(msg->str, fout) != EOF ? tlisp_true : tlisp_false;
+    return fwrite(msg->str, 1, msg->str_len, fout) == msg->str_len ? tlisp_true : tlisp_false;
 }
 
 tlisp_obj_t *tlisp_close(tlisp_obj_t *args, env_t *env)
@@ -1099,10 +1535,133 @@ tlisp_obj_t *tlisp_close(tlisp_obj_t *args, env_t *env)
     tlisp_obj_t *fobj;
 
     assert_nargs(1, args, env->proc);
-    fobj = eval(arg_at(0, args), env);
+    fobj = eval_car(args, env);
     return proc_close(env->proc, fobj) ? tlisp_true : tlisp_false;
 }
 
+void assert_num(tlisp_obj_t *obj, process_t *proc)
+{
+    if (OBJ_TAG(obj) != NUM && OBJ_TAG(obj) != FLOAT) {
+        char errstr[256];
+        char objstr[128];
+        snprintf(errstr, 256, "ERROR: Wrong type for %s (%s). Expected number.\n",
+                 obj_nstr(obj, objstr, 128), tag_str(OBJ_TAG(obj)));
+        proc_fatal(proc, errstr);
+    }
+}
+
+static
+tlisp_obj_t *make_int(int64_t n, process_t *proc)
+{
+    tlisp_obj_t *obj;
+
+    if (n >= FIXNUM_MIN && n <= FIXNUM_MAX) {
+        return FIXNUM(n);
+    }
+    obj = proc_new_num(proc);
+    obj->num = n;
+    return obj;
+}
+
+static
+tlisp_obj_t *make_float(double d, process_t *proc)
+{
+    tlisp_obj_t *obj = proc_new_float(proc);
+    obj->fnum = d;
+    return obj;
+}
+
+static
+double float_val(tlisp_obj_t *obj)
+{
+    return OBJ_TAG(obj) == FLOAT ? obj->fnum : (double)NUM_VAL(obj);
+}
+
+// The fixnum cases work on the tagged words: with a = 2x+1 and
+// b = 2y+1, (a-1)+b is the tagged x+y, and the word overflows exactly
+// when the result leaves the fixnum range. Everything else, including
+// results that overflow, falls through to the boxed int64 and double
+// paths. Integers that overflow int64 are promoted to doubles.
+tlisp_obj_t *arith(enum arith_op_t op, tlisp_obj_t *a, tlisp_obj_t *b, process_t *proc)
+{
+    intptr_t t;
+    int64_t x, y, r;
+
+    if (IS_FIXNUM(a) && IS_FIXNUM(b)) {
+        switch (op) {
+        case OP_ADD:
+            if (!__builtin_add_overflow((intptr_t)a - 1, (intptr_t)b, &t)) {
+                return (tlisp_obj_t *)t;
+            }
+            break;
+        case OP_SUB:
+            if (!__builtin_sub_overflow((intptr_t)a, (intptr_t)b - 1, &t)) {
+                return (tlisp_obj_t *)t;
+            }
+            break;
+        case OP_MUL:
+            if (!__builtin_mul_overflow((intptr_t)FIXNUM_VAL(a), (intptr_t)b - 1, &t)) {
+                return (tlisp_obj_t *)(t + 1);
+            }
+            break;
+        case OP_AND:
+            return (tlisp_obj_t *)((intptr_t)a & (intptr_t)b);
+        case OP_OR:
+            return (tlisp_obj_t *)((intptr_t)a | (intptr_t)b);
+        case OP_XOR:
+            return (tlisp_obj_t *)(((intptr_t)a ^ (intptr_t)b) | 1);
+        case OP_DIV:
+            break;
+        }
+    }
+    assert_num(a, proc);
+    assert_num(b, proc);
+    if (OBJ_TAG(a) == FLOAT || OBJ_TAG(b) == FLOAT) {
+        double fx = float_val(a);
+        double fy = float_val(b);
+        switch (op) {
+        case OP_ADD: return make_float(fx + fy, proc);
+        case OP_SUB: return make_float(fx - fy, proc);
+        case OP_MUL: return make_float(fx * fy, proc);
+        case OP_DIV: return make_float(fx / fy, proc);
+        default:
+            proc_fatal(proc, "ERROR: Bitwise operation on a float.\n");
+        }
+    }
+    x = NUM_VAL(a);
+    y = NUM_VAL(b);
+    switch (op) {
+    case OP_ADD:
+        if (__builtin_add_overflow(x, y, &r)) {
+            return make_float((double)x + (double)y, proc);
+        }
+        break;
+    case OP_SUB:
+        if (__builtin_sub_overflow(x, y, &r)) {
+            return make_float((double)x - (double)y, proc);
+        }
+        break;
+    case OP_MUL:
+        if (__builtin_mul_overflow(x, y, &r)) {
+            return make_float((double)x * (double)y, proc);
+        }
+        break;
+    case OP_DIV:
+        if (y == 0) {
+            proc_fatal(proc, "ERROR: Division by zero.\n");
+        }
+        if (x == INT64_MIN && y == -1) {
+            return make_float(-(double)x, proc);
+        }
+        r = x / y;
+        break;
+    case OP_AND: r = x & y; break;
+    case OP_OR: r = x | y; break;
+    case OP_XOR: r = x ^ y; break;
+    }
+    return make_int(r, proc);
+}
+
 #define DEF_ARITH_OP(name, op)                                 \
     tlisp_obj_t *tlisp_##name(tlisp_obj_t *args, env_t *env)   \
     {                                                          \
@@ -1112,23 +1671,23 @@ tlisp_obj_t *tlisp_close(tlisp_obj_t *args, env_t *env)
         if (!args) {                                           \
             return tlisp_nil;                                  \
         }                                                      \
-        curr = eval(args->car, env);                           \
-        assert_type(curr, NUM, env->proc);                     \
-        res = num_cpy(curr, env->proc);                        \
+        res = eval_car(args, env);                             \
+        assert_num(res, env->proc);                            \
+        proc_push_root(env->proc, &res);                       \
         while ((args = args->cdr)) {                           \
-            curr = eval(args->car, env);                       \
-            assert_type(curr, NUM, env->proc);                 \
-            res->num op##= curr->num;                          \
+            curr = eval_car(args, env);                        \
+            res = arith(op, res, curr, env->proc);             \
         }                                                      \
+        proc_pop_roots(env->proc, 1);                          \
         return res;                                            \
     }                                                          \
 
-DEF_ARITH_OP(add, +)
-DEF_ARITH_OP(mul, *)
-DEF_ARITH_OP(div, /)
-DEF_ARITH_OP(arith_and, &)
-DEF_ARITH_OP(arith_or, |)
-DEF_ARITH_OP(xor, ^)
+DEF_ARITH_OP(add, OP_ADD)
+DEF_ARITH_OP(mul, OP_MUL)
+DEF_ARITH_OP(div, OP_DIV)
+DEF_ARITH_OP(arith_and, OP_AND)
+DEF_ARITH_OP(arith_or, OP_OR)
+DEF_ARITH_OP(xor, OP_XOR)
 
 tlisp_obj_t *tlisp_sub(tlisp_obj_t *args, env_t *env)
 {
@@ -1138,51 +1697,82 @@ tlisp_obj_t *tlisp_sub(tlisp_obj_t *args, env_t *env)
     if (!args) {
         return tlisp_nil;
     }
-    curr = eval(args->car, env);
-    assert_type(curr, NUM, env->proc);
-    res = num_cpy(curr, env->proc);
+    res = eval_car(args, env);
     if (!args->cdr) {
-        res->num = -res->num;
-        return res;
+        return arith(OP_SUB, FIXNUM(0), res, env->proc);
     }
+    assert_num(res, env->proc);
+    proc_push_root(env->proc, &res);
     while ((args = args->cdr)) {
-        tlisp_obj_t *curr = eval(args->car, env);
-        assert_type(curr, NUM, env->proc);
-        res->num -= curr->num;
+        curr = eval_car(args, env);
+        res = arith(OP_SUB, res, curr, env->proc);
     }
+    proc_pop_roots(env->proc, 1);
     return res;
 }    
 
-#define DEF_CMP_OP(name, op)                                    \
-    tlisp_obj_t *tlisp_##name(tlisp_obj_t *args, env_t *env)    \
-    {                                                           \
-        tlisp_obj_t *arg_a, *arg_b;                             \
-        int a, b;                                               \
-                                                                \
-        assert_nargs(2, args, env->proc);                       \
-        arg_a = eval(arg_at(0, args), env);                     \
-        arg_b = eval(arg_at(1, args), env);                     \
-        assert_type(arg_a, NUM, env->proc);                     \
-        assert_type(arg_b, NUM, env->proc);                     \
-                                                                \
-        a = arg_a->num;                                         \
-        b = arg_b->num;                                         \
-        return (a op b) ? tlisp_true : tlisp_false;             \
+// Two fixnums compare the same way their tagged words do.
+#define CMP(op, a, b)                                           \
+    switch (op) {                                               \
+    case CMP_GT: return tlisp_bool((a) > (b));                  \
+    case CMP_LT: return tlisp_bool((a) < (b));                  \
+    case CMP_GEQ: return tlisp_bool((a) >= (b));                \
+    case CMP_LEQ: return tlisp_bool((a) <= (b));                \
     }                                                           \
 
-DEF_CMP_OP(greater_than, >)
-DEF_CMP_OP(less_than, <)
-DEF_CMP_OP(geq, >=)
-DEF_CMP_OP(leq, <=)
+tlisp_obj_t *num_compare(enum cmp_op_t op, tlisp_obj_t *a, tlisp_obj_t *b, process_t *proc)
+{
+    if (IS_FIXNUM(a) && IS_FIXNUM(b)) {
+        CMP(op, (intptr_t)a, (intptr_t)b);
+    }
+    assert_num(a, proc);
+    assert_num(b, proc);
+    if (OBJ_TAG(a) == FLOAT || OBJ_TAG(b) == FLOAT) {
+        CMP(op, float_val(a), float_val(b));
+    }
+    CMP(op, NUM_VAL(a), NUM_VAL(b));
+    return tlisp_false;
+}
+
+#define DEF_CMP_OP(name, op)                                            \
+    tlisp_obj_t *tlisp_##name(tlisp_obj_t *args, env_t *env)            \
+    {                                                                   \
+        tlisp_obj_t *arg_a, *arg_b;                                     \
+                                                                        \
+        assert_nargs(2, args, env->proc);                               \
+        arg_a = eval_car(args, env);                                    \
+        proc_push_root(env->proc, &arg_a);                              \
+        arg_b = eval_car(args->cdr, env);                               \
+        proc_pop_roots(env->proc, 1);                                   \
+        return num_compare(op, arg_a, arg_b, env->proc);                \
+    }                                                                   \
+
+DEF_CMP_OP(greater_than, CMP_GT)
+DEF_CMP_OP(less_than, CMP_LT)
+DEF_CMP_OP(geq, CMP_GEQ)
+DEF_CMP_OP(leq, CMP_LEQ)
+
+tlisp_obj_t *eq_values(tlisp_obj_t *a, tlisp_obj_t *b)
+{
+    enum obj_tag_t tag_a = OBJ_TAG(a);
+    enum obj_tag_t tag_b = OBJ_TAG(b);
+
+    if ((tag_a == FLOAT && tag_b == NUM) || (tag_a == NUM && tag_b == FLOAT)) {
+        return tlisp_bool(float_val(a) == float_val(b));
+    }
+    return tlisp_bool(obj_equals(a, b));
+}
 
 tlisp_obj_t *tlisp_equals(tlisp_obj_t *args, env_t *env)
 {
     tlisp_obj_t *arg_a, *arg_b;
 
     assert_nargs(2, args, env->proc);
-    arg_a = eval(arg_at(0, args), env);
-    arg_b = eval(arg_at(1, args), env);
-    return tlisp_bool(obj_equals(arg_a, arg_b));
+    arg_a = eval_car(args, env);
+    proc_push_root(env->proc, &arg_a);
+    arg_b = eval_car(args->cdr, env);
+    proc_pop_roots(env->proc, 1);
+    return eq_values(arg_a, arg_b);
 }
 
 #define DEF_BOOL_OP(name, op)                                     \
@@ -1192,8 +1782,10 @@ tlisp_obj_t *tlisp_equals(tlisp_obj_t *args, env_t *env)
         int a, b;                                                 \
                                                                   \
         assert_nargs(2, args, env->proc);                         \
-        arg_a = eval(arg_at(0, args), env);                       \
-        arg_b = eval(arg_at(1, args), env);                       \
+        arg_a = eval_car(args, env);                              \
+        proc_push_root(env->proc, &arg_a);                        \
+        arg_b = eval_car(args->cdr, env);                         \
+        proc_pop_roots(env->proc, 1);                             \
         assert_type(arg_a, BOOL, env->proc);                      \
         assert_type(arg_b, BOOL, env->proc);                      \
                                                                   \
@@ -1205,12 +1797,65 @@ tlisp_obj_t *tlisp_equals(tlisp_obj_t *args, env_t *env)
 DEF_BOOL_OP(and, &&)
 DEF_BOOL_OP(or, ||)
 
+tlisp_obj_t *bool_not(tlisp_obj_t *arg, process_t *proc)
+{
+    assert_type(arg, BOOL, proc);
+    return c_bool(arg) ? tlisp_false : tlisp_true; 
+}
+
 tlisp_obj_t *tlisp_not(tlisp_obj_t *args, env_t *env)
 {
-    tlisp_obj_t *arg;
-    
     assert_nargs(1, args, env->proc);
-    arg = eval(args->car, env);
-    assert_type(arg, BOOL, env->proc);
-    return c_bool(arg) ? tlisp_false : tlisp_true; 
+    return bool_not(eval_car(args, env), env->proc);
+}
+
+static
+void stats_ins(tlisp_obj_t *dict, const char *name, tlisp_obj_t *val, process_t *proc)
+{
+    tlisp_obj_t *key;
+
+    proc_push_root(proc, &val);
+    key = proc_new_str(proc, pool_strdup(name), strlen(name));
+    dict_ins(&dict->dict, key, val);
+    gc_write_barrier(proc, dict, key);
+    gc_write_barrier(proc, dict, val);
+    proc_pop_roots(proc, 1);
+}
+
+tlisp_obj_t *tlisp_gc_stats(tlisp_obj_t *args, env_t *env)
+{
+    process_t *proc = env->proc;
+    gc_stats_t stats = proc->gc_stats;
+    size_t heap_len = proc->heap_len;
+    size_t heap_cap = proc->heap_cap;
+    size_t nalive = proc->nalive;
+    size_t tag_bytes[NUM_TAGS];
+    tlisp_obj_t *res;
+    tlisp_obj_t *bytes;
+    int tag;
+
+    // Take every reading up front, since building the result
+    // allocates and may itself trigger a collection.
+    assert_nargs(0, args, proc);
+    gc_tag_bytes(proc, tag_bytes);
+    res = proc_new_dict(proc);
+    proc_push_root(proc, &res);
+    bytes = proc_new_dict(proc);
+    proc_push_root(proc, &bytes);
+    for (tag = 0; tag < NUM_TAGS; tag++) {
+        if (tag_bytes[tag]) {
+            stats_ins(bytes, tag_str(tag), FIXNUM(tag_bytes[tag]), proc);
+        }
+    }
+    stats_ins(res, "heap_len", FIXNUM(heap_len), proc);
+    stats_ins(res, "heap_cap", FIXNUM(heap_cap), proc);
+    stats_ins(res, "nalive", FIXNUM(nalive), proc);
+    stats_ins(res, "bytes", bytes, proc);
+    stats_ins(res, "collections", FIXNUM(stats.nminor + stats.nfull), proc);
+    stats_ins(res, "minor_collections", FIXNUM(stats.nminor), proc);
+    stats_ins(res, "full_collections", FIXNUM(stats.nfull), proc);
+    stats_ins(res, "pause_total_us", FIXNUM(stats.pause_total_us), proc);
+    stats_ins(res, "pause_max_us", FIXNUM(stats.pause_max_us), proc);
+    proc_pop_roots(proc, 2);
+    return res;
 }
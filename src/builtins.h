@@ -13,6 +13,9 @@ tlisp_obj_t *tlisp_true;
 tlisp_obj_t *tlisp_false;
 
 tlisp_obj_t *eval(tlisp_obj_t *obj, env_t *);
+tlisp_obj_t *apply_obj(tlisp_obj_t *fn, tlisp_obj_t *args, env_t *);
+tlisp_obj_t *run_lambda(tlisp_obj_t *fn, env_t *);
+void resolve_locals(tlisp_obj_t *expr, env_t *);
 
 // ----------------------------------------
 // Core
@@ -38,6 +41,7 @@ tlisp_obj_t *tlisp_car(tlisp_obj_t *, env_t *);
 tlisp_obj_t *tlisp_cdr(tlisp_obj_t *, env_t *);
 tlisp_obj_t *tlisp_print(tlisp_obj_t *, env_t *);
 tlisp_obj_t *tlisp_str(tlisp_obj_t *, env_t *);
+tlisp_obj_t *tlisp_string_builder(tlisp_obj_t *, env_t *);
 
 // ----------------------------------------
 // Collections
@@ -83,4 +87,35 @@ tlisp_obj_t *tlisp_and(tlisp_obj_t *, env_t *);
 tlisp_obj_t *tlisp_or(tlisp_obj_t *, env_t *);
 tlisp_obj_t *tlisp_not(tlisp_obj_t *, env_t *);
 
+// The basic ops on values already evaluated, for the VM.
+enum arith_op_t {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_AND,
+    OP_OR,
+    OP_XOR
+};
+
+enum cmp_op_t {
+    CMP_GT,
+    CMP_LT,
+    CMP_GEQ,
+    CMP_LEQ
+};
+
+void assert_num(tlisp_obj_t *, process_t *);
+tlisp_obj_t *arith(enum arith_op_t, tlisp_obj_t *, tlisp_obj_t *, process_t *);
+tlisp_obj_t *num_compare(enum cmp_op_t, tlisp_obj_t *, tlisp_obj_t *, process_t *);
+tlisp_obj_t *eq_values(tlisp_obj_t *, tlisp_obj_t *);
+tlisp_obj_t *bool_not(tlisp_obj_t *, process_t *);
+tlisp_obj_t *car_of(tlisp_obj_t *, process_t *);
+tlisp_obj_t *cdr_of(tlisp_obj_t *, process_t *);
+
+// ----------------------------------------
+// Runtime
+// ----------------------------------------
+tlisp_obj_t *tlisp_gc_stats(tlisp_obj_t *, env_t *);
+
 #endif
@@ -0,0 +1,564 @@
+
+#include "builtins.h"
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Where a guarded builtin's code falls back to eval, emitted after
+// the rest of the code so that it's out of the way.
+typedef struct fallback_t {
+    int hole;
+    tlisp_obj_t *form;
+    int resume;
+} fallback_t;
+
+typedef struct compiler_t {
+    env_t *env;
+    arena_t *arena;
+    intptr_t *code;
+    int len;
+    int cap;
+    int depth;
+    int max_stack;
+    int nenvs;
+    int max_envs;
+    tlisp_obj_t **locals;
+    int nlocals;
+    int locals_cap;
+    scope_t *scope;
+    fallback_t *fallbacks;
+    int nfallbacks;
+    int fallbacks_cap;
+} compiler_t;
+
+static void compile_expr(compiler_t *, tlisp_obj_t *, int tail);
+
+static
+void compiler_init(compiler_t *c, env_t *env, arena_t *arena)
+{
+    c->env = env;
+    c->arena = arena;
+    c->cap = 64;
+    c->len = 0;
+    c->code = malloc(sizeof(intptr_t) * c->cap);
+    c->depth = 0;
+    c->max_stack = 0;
+    c->nenvs = 0;
+    c->max_envs = 0;
+    c->locals_cap = 16;
+    c->nlocals = 0;
+    c->locals = malloc(sizeof(tlisp_obj_t *) * c->locals_cap);
+    c->scope = NULL;
+    c->fallbacks_cap = 16;
+    c->nfallbacks = 0;
+    c->fallbacks = malloc(sizeof(fallback_t) * c->fallbacks_cap);
+}
+
+static
+void emit(compiler_t *c, intptr_t word)
+{
+    if (c->len == c->cap) {
+        c->cap *= 2;
+        c->code = realloc(c->code, sizeof(intptr_t) * c->cap);
+    }
+    c->code[c->len] = word;
+    c->len++;
+}
+
+// Emits op and tracks how far it moves the value stack.
+static
+void emit_op(compiler_t *c, enum vm_op_t op, int delta)
+{
+    emit(c, op);
+    c->depth += delta;
+    if (c->depth > c->max_stack) {
+        c->max_stack = c->depth;
+    }
+}
+
+static
+void emit_obj(compiler_t *c, tlisp_obj_t *obj)
+{
+    emit(c, (intptr_t)obj);
+}
+
+// Emits a jump target to be filled in by patch.
+static
+int emit_hole(compiler_t *c)
+{
+    emit(c, 0);
+    return c->len - 1;
+}
+
+static
+void patch(compiler_t *c, int hole)
+{
+    c->code[hole] = c->len;
+}
+
+static
+vm_chunk_t *compiler_finish(compiler_t *c)
+{
+    vm_chunk_t *chunk = arena_alloc(c->arena, sizeof(vm_chunk_t));
+    int i;
+
+    for (i = 0; i < c->nfallbacks; i++) {
+        patch(c, c->fallbacks[i].hole);
+        emit(c, VM_EVAL);
+        emit(c, (intptr_t)c->fallbacks[i].form);
+        emit(c, VM_JUMP);
+        emit(c, c->fallbacks[i].resume);
+    }
+    chunk->code = arena_alloc(c->arena, sizeof(intptr_t) * c->len);
+    memcpy(chunk->code, c->code, sizeof(intptr_t) * c->len);
+    chunk->len = c->len;
+    chunk->max_stack = c->max_stack;
+    chunk->max_envs = c->max_envs;
+    free(c->code);
+    free(c->locals);
+    free(c->fallbacks);
+    return chunk;
+}
+
+static
+void open_env(compiler_t *c)
+{
+    c->nenvs++;
+    if (c->nenvs > c->max_envs) {
+        c->max_envs = c->nenvs;
+    }
+}
+
+static
+void add_local(compiler_t *c, tlisp_obj_t *sym)
+{
+    if (c->nlocals == c->locals_cap) {
+        c->locals_cap *= 2;
+        c->locals = realloc(c->locals, sizeof(tlisp_obj_t *) * c->locals_cap);
+    }
+    c->locals[c->nlocals] = sym;
+    c->nlocals++;
+}
+
+static
+int is_local(compiler_t *c, tlisp_obj_t *sym)
+{
+    int i;
+
+    for (i = 0; i < c->nlocals; i++) {
+        if (c->locals[i] == sym) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The builtin a form's head is globally bound to, unless something
+// the code binds itself may shadow it. A caller's frame still may, so
+// the code compiled for it is guarded; see compile_guarded.
+static
+tlisp_obj_t *builtin_of(compiler_t *c, tlisp_obj_t *head)
+{
+    tlisp_obj_t *obj;
+
+    if (OBJ_TAG(head) != SYMBOL || is_local(c, head)) {
+        return NULL;
+    }
+    obj = env_find(c->env->proc->genv, head);
+    return obj && OBJ_TAG(obj) == NFUNC ? obj : NULL;
+}
+
+// The number of elements in a proper list, or -1.
+static
+int form_len(tlisp_obj_t *list)
+{
+    int len = 0;
+
+    while (list) {
+        if (OBJ_TAG(list) != CONS) {
+            return -1;
+        }
+        list = list->cdr;
+        len++;
+    }
+    return len;
+}
+
+static
+void compile_const(compiler_t *c, tlisp_obj_t *obj)
+{
+    emit_op(c, VM_CONST, 1);
+    emit_obj(c, obj);
+}
+
+static
+void compile_native(compiler_t *c, tlisp_obj_t *form, tlisp_fn fn)
+{
+    emit_op(c, VM_NATIVE, 1);
+    emit_obj(c, form);
+    emit(c, (intptr_t)fn);
+}
+
+static
+void compile_if(compiler_t *c, tlisp_obj_t *args, int nargs, int tail)
+{
+    int else_hole, end_hole;
+
+    compile_expr(c, args->car, 0);
+    emit_op(c, VM_JUMP_UNLESS, -1);
+    else_hole = emit_hole(c);
+    compile_expr(c, args->cdr->car, tail);
+    emit_op(c, VM_JUMP, 0);
+    end_hole = emit_hole(c);
+    c->depth--;
+    patch(c, else_hole);
+    if (nargs == 3) {
+        compile_expr(c, args->cdr->cdr->car, tail);
+    } else {
+        compile_const(c, tlisp_nil);
+    }
+    patch(c, end_hole);
+}
+
+static
+void compile_while(compiler_t *c, tlisp_obj_t *args)
+{
+    int top = c->len;
+    int end_hole;
+
+    compile_expr(c, args->car, 0);
+    emit_op(c, VM_JUMP_UNLESS, -1);
+    end_hole = emit_hole(c);
+    compile_expr(c, args->cdr->car, 0);
+    emit_op(c, VM_POP, -1);
+    emit_op(c, VM_JUMP, 0);
+    emit(c, top);
+    patch(c, end_hole);
+    compile_const(c, tlisp_nil);
+}
+
+static
+void compile_do(compiler_t *c, tlisp_obj_t *args, int tail)
+{
+    if (!args) {
+        compile_const(c, tlisp_nil);
+        return;
+    }
+    while (args) {
+        compile_expr(c, args->car, tail && !args->cdr);
+        args = args->cdr;
+        if (args) {
+            emit_op(c, VM_POP, -1);
+        }
+    }
+}
+
+// Bindings are evaluated in the enclosing env and the body in the
+// let's own. A let is always nil.
+static
+int compile_let(compiler_t *c, tlisp_obj_t *args)
+{
+    tlisp_obj_t *bindings = args->car;
+    int nlocals = c->nlocals;
+    int len = form_len(bindings);
+    scope_t scope;
+
+    if (len <= 0 || len % 2) {
+        return 0;
+    }
+    for (; bindings; bindings = bindings->cdr->cdr) {
+        if (OBJ_TAG(bindings->car) != SYMBOL) {
+            return 0;
+        }
+    }
+    emit_op(c, VM_LET, 0);
+    open_env(c);
+    for (bindings = args->car; bindings; bindings = bindings->cdr->cdr) {
+        compile_expr(c, bindings->cdr->car, 0);
+        emit_op(c, VM_BIND, -1);
+        emit_obj(c, bindings->car);
+    }
+    for (bindings = args->car; bindings; bindings = bindings->cdr->cdr) {
+        add_local(c, bindings->car);
+    }
+    scope.names = args->car;
+    scope.step = 2;
+    scope.outer = c->scope;
+    c->scope = &scope;
+    emit_op(c, VM_LET_BODY, 0);
+    compile_expr(c, args->cdr->car, 0);
+    emit_op(c, VM_POP, -1);
+    emit_op(c, VM_LET_END, 0);
+    c->nenvs--;
+    c->nlocals = nlocals;
+    c->scope = scope.outer;
+    compile_const(c, tlisp_nil);
+    return 1;
+}
+
+static
+int compile_lambda(compiler_t *c, tlisp_obj_t *form)
+{
+    tlisp_obj_t *args = form->cdr;
+    tlisp_obj_t *params;
+    tlisp_obj_t *body;
+    compiler_t inner;
+    scope_t scope;
+    int i;
+
+    if (form_len(args) < 2 || OBJ_TAG(args->car) != CONS || form_len(args->car) < 0) {
+        return 0;
+    }
+    for (params = args->car; params; params = params->cdr) {
+        if (OBJ_TAG(params->car) != SYMBOL) {
+            return 0;
+        }
+    }
+
+    // The body is compiled now, while the arena can still be
+    // allocated from, and only runs once the lambda is called.
+    compiler_init(&inner, c->env, c->arena);
+    for (i = 0; i < c->nlocals; i++) {
+        add_local(&inner, c->locals[i]);
+    }
+    for (params = args->car; params; params = params->cdr) {
+        add_local(&inner, params->car);
+    }
+    scope.names = args->car;
+    scope.step = 1;
+    scope.outer = NULL;
+    inner.scope = &scope;
+    for (body = args->cdr; body; body = body->cdr) {
+        compile_expr(&inner, body->car, !body->cdr);
+        if (body->cdr) {
+            emit_op(&inner, VM_POP, -1);
+        }
+    }
+    emit_op(&inner, VM_RETURN, -1);
+    emit_op(c, VM_LAMBDA, 1);
+    emit_obj(c, form);
+    emit(c, (intptr_t)compiler_finish(&inner));
+    return 1;
+}
+
+// Arithmetic folds left over its arguments, checking the first is a
+// number before evaluating the rest.
+static
+void compile_arith(compiler_t *c, tlisp_obj_t *args, enum arith_op_t op)
+{
+    compile_expr(c, args->car, 0);
+    emit_op(c, VM_ASSERT_NUM, 0);
+    while ((args = args->cdr)) {
+        compile_expr(c, args->car, 0);
+        emit_op(c, VM_ARITH, -1);
+        emit(c, op);
+    }
+}
+
+static
+void compile_binary(compiler_t *c, tlisp_obj_t *args, enum vm_op_t op)
+{
+    compile_expr(c, args->car, 0);
+    compile_expr(c, args->cdr->car, 0);
+    emit_op(c, op, -1);
+}
+
+static
+int arith_op_of(tlisp_fn fn, enum arith_op_t *op)
+{
+    if (fn == tlisp_add) *op = OP_ADD;
+    else if (fn == tlisp_sub) *op = OP_SUB;
+    else if (fn == tlisp_mul) *op = OP_MUL;
+    else if (fn == tlisp_div) *op = OP_DIV;
+    else if (fn == tlisp_arith_and) *op = OP_AND;
+    else if (fn == tlisp_arith_or) *op = OP_OR;
+    else if (fn == tlisp_xor) *op = OP_XOR;
+    else return 0;
+    return 1;
+}
+
+static
+int cmp_op_of(tlisp_fn fn, enum cmp_op_t *op)
+{
+    if (fn == tlisp_greater_than) *op = CMP_GT;
+    else if (fn == tlisp_less_than) *op = CMP_LT;
+    else if (fn == tlisp_geq) *op = CMP_GEQ;
+    else if (fn == tlisp_leq) *op = CMP_LEQ;
+    else return 0;
+    return 1;
+}
+
+// Compiles a form whose head names a builtin. Anything malformed is
+// left to the builtin, so errors come out just as they do from eval.
+static
+void compile_builtin(compiler_t *c, tlisp_obj_t *form, tlisp_fn fn, int tail)
+{
+    tlisp_obj_t *args = form->cdr;
+    int nargs = form_len(args);
+    enum arith_op_t arith_op;
+    enum cmp_op_t cmp_op;
+
+    if (fn == tlisp_quote_fn && args) {
+        compile_const(c, args);
+        return;
+    }
+    if (nargs < 0) {
+        compile_native(c, form, fn);
+        return;
+    }
+    if (fn == tlisp_if && (nargs == 2 || nargs == 3)) {
+        compile_if(c, args, nargs, tail);
+    } else if (fn == tlisp_while && nargs == 2) {
+        compile_while(c, args);
+    } else if (fn == tlisp_do) {
+        compile_do(c, args, tail);
+    } else if (fn == tlisp_let && nargs == 2 && OBJ_TAG(args->car) == CONS
+               && compile_let(c, args)) {
+        return;
+    } else if (fn == tlisp_def && nargs == 2 && OBJ_TAG(args->car) == SYMBOL) {
+        compile_expr(c, args->cdr->car, 0);
+        emit_op(c, VM_DEF, 0);
+        emit_obj(c, args->car);
+        add_local(c, args->car);
+    } else if (fn == tlisp_set && nargs == 2 && OBJ_TAG(args->car) == SYMBOL) {
+        compile_expr(c, args->cdr->car, 0);
+        emit_op(c, VM_SET, 0);
+        emit_obj(c, args->car);
+    } else if (fn == tlisp_lambda && compile_lambda(c, form)) {
+        return;
+    } else if (arith_op_of(fn, &arith_op) && nargs >= (fn == tlisp_sub ? 2 : 1)) {
+        compile_arith(c, args, arith_op);
+    } else if (cmp_op_of(fn, &cmp_op) && nargs == 2) {
+        compile_binary(c, args, VM_COMPARE);
+        emit(c, cmp_op);
+    } else if (fn == tlisp_equals && nargs == 2) {
+        compile_binary(c, args, VM_EQ);
+    } else if (fn == tlisp_not && nargs == 1) {
+        compile_expr(c, args->car, 0);
+        emit_op(c, VM_NOT, 0);
+    } else if (fn == tlisp_car && nargs == 1) {
+        compile_expr(c, args->car, 0);
+        emit_op(c, VM_CAR, 0);
+    } else if (fn == tlisp_cdr && nargs == 1) {
+        compile_expr(c, args->car, 0);
+        emit_op(c, VM_CDR, 0);
+    } else {
+        compile_native(c, form, fn);
+    }
+}
+
+// Scoping is dynamic, so a builtin's name may be bound by a frame by
+// the time the code runs, or set! to something else. The code for
+// the builtin only runs if it's still what the name means; otherwise
+// the form is left to eval.
+static
+void compile_guarded(compiler_t *c, tlisp_obj_t *form, tlisp_obj_t *builtin, int tail)
+{
+    fallback_t fallback;
+
+    emit_op(c, VM_GUARD, 0);
+    emit_obj(c, form->car);
+    emit_obj(c, builtin);
+    fallback.hole = emit_hole(c);
+    fallback.form = form;
+    compile_builtin(c, form, builtin->fn, tail);
+    fallback.resume = c->len;
+    if (c->nfallbacks == c->fallbacks_cap) {
+        c->fallbacks_cap *= 2;
+        c->fallbacks = realloc(c->fallbacks, sizeof(fallback_t) * c->fallbacks_cap);
+    }
+    c->fallbacks[c->nfallbacks] = fallback;
+    c->nfallbacks++;
+}
+
+// A call to anything else is decided at run time. Lambdas have their
+// arguments evaluated and bound one at a time in the new env, as
+// bind_args does; other objects are applied to the unevaluated
+// form, and skip over the argument code. A call in tail position may
+// reuse the caller's frame, as run_lambda's do.
+static
+void compile_call(compiler_t *c, tlisp_obj_t *form, int tail)
+{
+    tlisp_obj_t *args;
+    int end_hole;
+    scope_t scope;
+
+    compile_expr(c, form->car, 0);
+    emit_op(c, VM_CALL, 1);
+    emit_obj(c, form);
+    end_hole = emit_hole(c);
+    open_env(c);
+    scope.names = NULL;
+    scope.step = 1;
+    scope.outer = c->scope;
+    c->scope = &scope;
+    for (args = form->cdr; args; args = args->cdr) {
+        emit_op(c, VM_ARG, 0);
+        compile_expr(c, args->car, 0);
+        emit_op(c, VM_BIND_ARG, -1);
+    }
+    emit_op(c, tail ? VM_TAIL_ENTER : VM_ENTER, -1);
+    c->nenvs--;
+    c->scope = scope.outer;
+    patch(c, end_hole);
+}
+
+static
+void compile_expr(compiler_t *c, tlisp_obj_t *expr, int tail)
+{
+    tlisp_obj_t *builtin;
+    int slot;
+
+    switch (expr ? OBJ_TAG(expr) : NIL) {
+    case BOOL:
+    case NUM:
+    case FLOAT:
+    case STRING:
+        compile_const(c, expr);
+        return;
+    case NIL:
+        if (expr) {
+            compile_const(c, expr);
+            return;
+        }
+        break;
+    case SYMBOL:
+        slot = scope_find(c->scope, expr);
+        if (slot) {
+            emit_op(c, VM_LOCAL, 1);
+            emit_obj(c, expr);
+            emit(c, slot);
+        } else {
+            emit_op(c, VM_LOOKUP, 1);
+            emit_obj(c, expr);
+        }
+        return;
+    case CONS:
+        builtin = builtin_of(c, expr->car);
+        if (form_len(expr->cdr) < 0 && !builtin) {
+            break;
+        }
+        if (builtin) {
+            compile_guarded(c, expr, builtin, tail);
+        } else {
+            compile_call(c, expr, tail);
+        }
+        return;
+    default:
+        break;
+    }
+
+    // Whatever's left is for eval to deal with.
+    emit_op(c, VM_EVAL, 1);
+    emit_obj(c, expr);
+}
+
+vm_chunk_t *vm_compile(tlisp_obj_t *expr, env_t *env, arena_t *arena)
+{
+    compiler_t c;
+
+    compiler_init(&c, env, arena);
+    compile_expr(&c, expr, 0);
+    emit_op(&c, VM_RETURN, -1);
+    return compiler_finish(&c);
+}
@@ -10,7 +10,9 @@ const char *tag_str(enum obj_tag_t t)
     switch (t) {
     case BOOL: return "bool";
     case NUM: return "num";
+    case FLOAT: return "float";
     case STRING: return "string";
+    case STRBUILDER: return "string-builder";
     case SYMBOL: return "symbol";
     case STRUCTDEF: return "structdef";
     case STRUCT: return "struct";
@@ -24,42 +26,108 @@ const char *tag_str(enum obj_tag_t t)
     }
 }
 
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+
+static
+uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static
+uint64_t hash_read(const char *p, size_t n)
+{
+    uint64_t v = 0;
+    memcpy(&v, p, n);
+    return v;
+}
+
+// A cut-down wyhash: sixteen bytes per multiply, then the tail.
+static
+uint64_t str_hash(const char *s, size_t len)
+{
+    uint64_t seed = HASH_P0 ^ len;
+    uint64_t a, b;
+
+    while (len > 16) {
+        seed = hash_mix(hash_read(s, 8) ^ HASH_P1, hash_read(s + 8, 8) ^ seed);
+        s += 16;
+        len -= 16;
+    }
+    a = hash_read(s, len < 8 ? len : 8);
+    b = len > 8 ? hash_read(s + 8, len - 8) : 0;
+    return hash_mix(HASH_P1 ^ len, hash_mix(a ^ HASH_P1, b ^ seed));
+}
+
+static
+uint64_t int_hash(uint64_t n)
+{
+    return hash_mix(n ^ HASH_P0, HASH_P1);
+}
+
+// Hashes agree with obj_equals: by value for numbers and strings, by
+// identity for everything that compares by identity.
 size_t obj_hash(tlisp_obj_t *obj)
 {
-    switch (obj->tag) {
-    case BOOL:
+    switch (OBJ_TAG(obj)) {
     case NUM:
+        return int_hash(NUM_VAL(obj));
+    case FLOAT: {
+        uint64_t bits;
+        double d = obj->fnum == 0 ? 0 : obj->fnum;
+        memcpy(&bits, &d, sizeof(bits));
+        return int_hash(bits);
+    }
     case STRING:
+        if (!obj->str_hash) {
+            obj->str_hash = str_hash(obj->str, obj->str_len);
+        }
+        return obj->str_hash;
     case SYMBOL:
+        return int_hash(obj->sym_hash);
+    case NFUNC:
+        return int_hash((uintptr_t)obj->fn);
+    case BOOL:
+    case STRBUILDER:
     case STRUCTDEF:
     case STRUCT:
     case CONS:
     case DICT:
     case VEC:
-    case NFUNC:
     case LAMBDA:
     case MACRO:
     case NIL:
         break;
     }
-    return 0;                   /* TODO: IMPL */
+    return int_hash((uintptr_t)obj);
 }
 
 int obj_equals(tlisp_obj_t *first, tlisp_obj_t *second)
 {
-    if (first->tag != second->tag) {
+    if (OBJ_TAG(first) != OBJ_TAG(second)) {
         return 0;
     }
-    switch (first->tag) {
+    switch (OBJ_TAG(first)) {
     case NUM:
-        return first->num == second->num;
+        return NUM_VAL(first) == NUM_VAL(second);
+    case FLOAT:
+        return first->fnum == second->fnum;
     case STRING:
-        return !strcmp(first->str, second->str);
-    case SYMBOL:
-        return !strcmp(first->sym, second->sym);
+        if (first->str_len != second->str_len) {
+            return 0;
+        }
+        if (first->str_hash && second->str_hash
+            && first->str_hash != second->str_hash) {
+            return 0;
+        }
+        return !memcmp(first->str, second->str, first->str_len);
     case NFUNC:
         return first->fn == second->fn;
     case BOOL:
+    case SYMBOL:
+    case STRBUILDER:
     case STRUCTDEF:
     case STRUCT:
     case CONS:
@@ -225,14 +293,34 @@ void vec_nstr(tlisp_obj_t *obj, char *str, size_t maxlen)
 #undef REMAINING
 }
 
+// Prints the shortest of %.15g and %.17g that reads back to the same
+// double, with a trailing ".0" so the result still reads as a float.
+static
+void float_nstr(double d, char *str, size_t maxlen)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%.15g", d);
+    if (strtod(buf, NULL) != d) {
+        snprintf(buf, sizeof(buf), "%.17g", d);
+    }
+    if (!strpbrk(buf, ".eni")) {
+        strcat(buf, ".0");
+    }
+    snprintf(str, maxlen, "%s", buf);
+}
+
 char *obj_nstr(tlisp_obj_t *obj, char *str, size_t maxlen)
 {
-    switch (obj->tag) {
+    switch (OBJ_TAG(obj)) {
     case BOOL:
         snprintf(str, maxlen, "%s", obj->num ? "true" : "false");
         break;
     case NUM:
-        snprintf(str, maxlen, "%d", obj->num);
+        snprintf(str, maxlen, "%lld", (long long)NUM_VAL(obj));
+        break;
+    case FLOAT:
+        float_nstr(obj->fnum, str, maxlen);
         break;
     case STRING:
         snprintf(str, maxlen, "%s", obj->str);
@@ -243,6 +331,9 @@ char *obj_nstr(tlisp_obj_t *obj, char *str, size_t maxlen)
     case CONS: 
         cons_nstr(obj, str, maxlen);
         break;
+    case STRBUILDER:
+        strncpy(str, "<string-builder>", maxlen);
+        break;
     case STRUCTDEF:
         strncpy(str, "<structdef>", maxlen);
         break;
@@ -278,25 +369,38 @@ void print_obj(tlisp_obj_t *obj)
     printf("%s\n", str);
 }
 
-#define DEF_CONSTRUCTOR(abbrev, tag_)                   \
-    tlisp_obj_t *new_##abbrev()                         \
-    {                                                   \
-        tlisp_obj_t *obj = malloc(sizeof(tlisp_obj_t)); \
-        obj->tag = tag_;                                \
-        obj->mark = 0;                                  \
-        return obj;                                     \
-    }                                                   \
+#define DEF_CONSTRUCTOR(abbrev, tag_)                                   \
+    tlisp_obj_t *new_##abbrev(arena_t *arena)                           \
+    {                                                                   \
+        tlisp_obj_t *obj = arena_alloc(arena, sizeof(tlisp_obj_t));     \
+        obj->tag = tag_;                                                \
+        obj->remembered = 0;                                            \
+        obj->in_arena = 1;                                              \
+        return obj;                                                     \
+    }                                                                   \
     
-DEF_CONSTRUCTOR(str, STRING)
-DEF_CONSTRUCTOR(sym, SYMBOL)
 DEF_CONSTRUCTOR(num, NUM)
+DEF_CONSTRUCTOR(float, FLOAT)
+
+tlisp_obj_t *new_str(arena_t *arena)
+{
+    tlisp_obj_t *obj = arena_alloc(arena, sizeof(tlisp_obj_t));
+    obj->tag = STRING;
+    obj->remembered = 0;
+    obj->in_arena = 1;
+    obj->str_hash = 0;
+    return obj;
+}
 
-tlisp_obj_t *new_cons()
+tlisp_obj_t *new_cons(arena_t *arena)
 {
-    tlisp_obj_t *obj = malloc(sizeof(tlisp_obj_t));
+    tlisp_obj_t *obj = arena_alloc(arena, sizeof(tlisp_obj_t));
     obj->tag = CONS;
-    obj->mark = 0;
+    obj->remembered = 0;
+    obj->in_arena = 1;
     obj->cdr = NULL; 
+    obj->ic_sdef = NULL;
+    obj->ic_idx = 0;
     return obj;
 }
 
@@ -306,10 +410,10 @@ void line_info_init(line_info_t *info, char *text)
     info->entries = NULL;
 }
 
-void line_info_add(line_info_t *info, tlisp_obj_t *obj,
+void line_info_add(line_info_t *info, arena_t *arena, tlisp_obj_t *obj,
                    int start_line, int end_line)
 {
-    line_info_entry_t *entry = malloc(sizeof(line_info_entry_t));
+    line_info_entry_t *entry = arena_alloc(arena, sizeof(line_info_entry_t));
 
     entry->obj = obj;
     entry->start_line = start_line;
@@ -372,6 +476,7 @@ void source_init(source_t *source, char *text)
     source->cap = 16;
     source->expressions = malloc(sizeof(tlisp_obj_t*) * source->cap);
     source->nexpressions = 0;
+    source->arena = arena_new();
 }
 
 void source_add_expr(source_t *source, tlisp_obj_t *expr,
@@ -379,9 +484,10 @@ void source_add_expr(source_t *source, tlisp_obj_t *expr,
 {
     if (source->nexpressions == source->cap) {
         source->cap *= 2;
-        source->expressions = realloc(source->expressions, source->cap);
+        source->expressions = realloc(source->expressions,
+                                      sizeof(tlisp_obj_t *) * source->cap);
     }
-    line_info_add(&source->line_info, expr, start_line, end_line);
+    line_info_add(&source->line_info, source->arena, expr, start_line, end_line);
     source->expressions[source->nexpressions] = expr;
     source->nexpressions++;
 }
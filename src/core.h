@@ -1,17 +1,23 @@
 #ifndef TLISP_CORE_H_
 #define TLISP_CORE_H_
 
+#include "arena.h"
 #include "dict.h"
+#include "strbuf.h"
 #include "struct.h"
 #include "vector.h"
 #include <stddef.h>
+#include <stdint.h>
 
 struct env_t; // Forward declaration.
+struct vm_chunk_t; // Forward declaration.
 
 enum obj_tag_t {
     BOOL,
     NUM,
+    FLOAT,
     STRING,
+    STRBUILDER,
     SYMBOL,
     CONS,
     STRUCTDEF,
@@ -23,37 +29,93 @@ enum obj_tag_t {
     MACRO,
     NIL
 };
+#define NUM_TAGS (NIL + 1)
 const char *tag_str(enum obj_tag_t);
 
 typedef struct tlisp_obj_t *(*tlisp_fn)(struct tlisp_obj_t*, struct env_t*);
 
 typedef struct tlisp_obj_t {
     union {
-        int num;
-        char *str;
-        char *sym;
+        int64_t num;
+        double fnum;
+        struct {
+            char *str;          // NUL-terminated, but may hold NULs
+            size_t str_len;
+            size_t str_hash;    // 0 until first hashed
+        };
+        struct {
+            char *sym;
+            size_t sym_hash;
+            int sym_id;         // Its slot in the global env
+            int sym_frames;     // How many live frames bind it
+        };
         struct {
             struct tlisp_obj_t *car;
             struct tlisp_obj_t *cdr;
+            // A cons holding a struct field name caches the
+            // structdef last accessed through it, with the field's
+            // index in ic_idx. Heap conses are compact and have no
+            // room for either, so only the reader's conses cache.
+            // A lambda compiled by the VM keeps its chunk here.
+            union {
+                tlisp_structdef_t *ic_sdef;
+                struct vm_chunk_t *code;
+            };
         };
         tlisp_structdef_t structdef;
         tlisp_struct_t structobj;
         tlisp_dict_t dict;
         tlisp_vector_t vec;
+        tlisp_strbuf_t strbuf;
         tlisp_fn fn;
     };
     enum obj_tag_t tag;
-    char mark;
+    char remembered;
+    char in_arena;
+    unsigned short ic_idx;
 } tlisp_obj_t;
 
+// Numbers are stored in the object pointer itself rather than in a
+// heap object. Real objects are at least 8-byte aligned, so a set low
+// bit can only mean a fixnum. Never dereference an object without
+// checking, and use OBJ_TAG rather than reading ->tag directly.
+// Integers outside the fixnum range are boxed NUM objects; use
+// NUM_VAL to read either kind.
+#define IS_FIXNUM(obj) ((uintptr_t)(obj) & 1)
+#define FIXNUM(n) ((tlisp_obj_t *)(((uintptr_t)(intptr_t)(n) << 1) | 1))
+#define FIXNUM_VAL(obj) ((int64_t)((intptr_t)(obj) >> 1))
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+#define NUM_VAL(obj) (IS_FIXNUM(obj) ? FIXNUM_VAL(obj) : (obj)->num)
+
+// Heap conses and boxed numbers are compact: just the payload, in a
+// 16-byte cell with no header after it, on a heap page holding only
+// that type. heap_tags has a byte per page of the heap's address
+// range, the type of its cells or -1 if its objects have headers.
+// Only OBJ_TAG and the collector may know the difference.
+#define HEAP_PAGE_SHIFT 16
+extern char *heap_tags_base;
+extern size_t heap_tags_span;
+extern signed char *heap_tags;
+#define HEAP_OFFSET(obj) ((uintptr_t)(obj) - (uintptr_t)heap_tags_base)
+#define COMPACT_TAG(obj) \
+    (HEAP_OFFSET(obj) < heap_tags_span ? heap_tags[HEAP_OFFSET(obj) >> HEAP_PAGE_SHIFT] : -1)
+#define IS_COMPACT(obj) (COMPACT_TAG(obj) >= 0)
+#define OBJ_TAG(obj) \
+    (IS_FIXNUM(obj) ? NUM : IS_COMPACT(obj) ? (enum obj_tag_t)COMPACT_TAG(obj) : (obj)->tag)
+
+// Heap objects bigger than a tlisp_obj_t keep their extra payload,
+// such as struct fields or vector elems, right after the header.
+#define OBJ_PAYLOAD(obj) ((void *)((obj) + 1))
+
 size_t obj_hash(tlisp_obj_t *);
 int obj_equals(tlisp_obj_t *, tlisp_obj_t *);
 char *obj_nstr(tlisp_obj_t *, char *out, size_t maxlen);
 void print_obj(tlisp_obj_t *);
-tlisp_obj_t *new_num(void);
-tlisp_obj_t *new_str(void);
-tlisp_obj_t *new_sym(void);
-tlisp_obj_t *new_cons(void);
+tlisp_obj_t *new_num(arena_t *);
+tlisp_obj_t *new_float(arena_t *);
+tlisp_obj_t *new_str(arena_t *);
+tlisp_obj_t *new_cons(arena_t *);
 
 typedef struct line_info_entry_t {
     int start_line;
@@ -68,14 +130,18 @@ typedef struct line_info_t {
 } line_info_t;
 
 void line_info_init(line_info_t *, char *text);
-void line_info_add(line_info_t *, tlisp_obj_t *, int start_line, int end_line);
+void line_info_add(line_info_t *, arena_t *, tlisp_obj_t *, int start_line, int end_line);
 void line_info_print(line_info_t *, tlisp_obj_t *);
 
+// Everything the reader builds for a source lives in its arena,
+// which outlives the source itself for as long as any of it is
+// still referenced.
 typedef struct source_t {
     size_t nexpressions;
     size_t cap;
     tlisp_obj_t **expressions;
     line_info_t line_info;
+    arena_t *arena;
 } source_t;
 
 void source_init(source_t *, char *text);
@@ -1,99 +1,199 @@
 
 #include "core.h"
 #include "dict.h"
+#include "pool.h"
 #include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MIN_CAP DICT_GROUP
+#define CTRL_EMPTY ((signed char)-128)
+#define CTRL_DELETED ((signed char)-2)
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((signed char)((hash) & 0x7f))
+#define MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+// Bit i of the result is set if control byte i of the group is c.
+static
+unsigned group_match(const signed char *group, signed char c)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    unsigned mask = 0;
+    int i;
 
-#define MIN_CAP 8
+    for (i = 0; i < DICT_GROUP; i++) {
+        mask |= (unsigned)(group[i] == c) << i;
+    }
+    return mask;
+#endif
+}
 
-void dict_init(tlisp_dict_t *dict)
+// Empty and deleted are the only control bytes with the top bit set.
+static
+unsigned group_match_free(const signed char *group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    unsigned mask = 0;
+    int i;
+
+    for (i = 0; i < DICT_GROUP; i++) {
+        mask |= (unsigned)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+static
+void dict_alloc(tlisp_dict_t *dict, int cap)
 {
     dict->len = 0;
-    dict->cap = MIN_CAP;
-    dict->entries = calloc(dict->cap, sizeof(tlisp_dict_entry_t));
+    dict->cap = cap;
+    dict->growth_left = MAX_LOAD(cap);
+    dict->ctrl = pool_alloc(cap + 2 * sizeof(tlisp_obj_t *) * cap);
+    memset(dict->ctrl, CTRL_EMPTY, cap);
+}
+
+void dict_init(tlisp_dict_t *dict)
+{
+    dict_alloc(dict, MIN_CAP);
 }
 
 void dict_destroy(tlisp_dict_t *dict)
 {
-    free(dict->entries);
+    pool_free(dict->ctrl);
 }
 
+// Probes whole groups, visiting each group once: the nth probe steps
+// n groups further on, and the triangular numbers cover every residue
+// of a power of two.
 static
-void dict_resize(tlisp_dict_t *dict, int cap)
+int dict_find(tlisp_dict_t *dict, tlisp_obj_t *key, size_t hash)
 {
-    tlisp_dict_entry_t *entries = dict->entries;
-    size_t old_cap = dict->cap;
-    int i;
-
-    dict->cap = cap;
-    dict->entries = calloc(dict->cap, sizeof(tlisp_dict_entry_t));
-    for (i = 0; i < old_cap; i++) {
-        if (entries[i].valid) {
-            dict_ins(dict, entries[i].key, entries[i].val);
-            dict->len--;
+    size_t mask = dict->cap / DICT_GROUP - 1;
+    size_t group = H1(hash) & mask;
+    size_t step = 0;
+    tlisp_obj_t **keys = DICT_KEYS(dict);
+
+    while (1) {
+        signed char *ctrl = dict->ctrl + group * DICT_GROUP;
+        unsigned match = group_match(ctrl, H2(hash));
+
+        while (match) {
+            int idx = group * DICT_GROUP + __builtin_ctz(match);
+            if (keys[idx] == key || obj_equals(keys[idx], key)) {
+                return idx;
+            }
+            match &= match - 1;
         }
+        if (group_match(ctrl, CTRL_EMPTY)) {
+            return -1;
+        }
+        group = (group + ++step) & mask;
     }
-    free(entries);
 }
 
-tlisp_obj_t *dict_ins(tlisp_dict_t *dict, tlisp_obj_t *key, tlisp_obj_t *val)
+static
+int dict_find_free(tlisp_dict_t *dict, size_t hash)
 {
-    size_t hash = obj_hash(key); 
-    size_t idx = hash % dict->cap;
+    size_t mask = dict->cap / DICT_GROUP - 1;
+    size_t group = H1(hash) & mask;
+    size_t step = 0;
 
-    if (dict->len >= (dict->cap * 3) / 4) {
-        dict_resize(dict, dict->cap * 2);
-        idx = hash % dict->cap;
-    }
-    while (dict->entries[idx].valid) {
-        if (obj_equals(dict->entries[idx].key, key)) {
-            tlisp_obj_t *old = dict->entries[idx].val;
-            dict->entries[idx].val = val;
-            return old;
+    while (1) {
+        unsigned match = group_match_free(dict->ctrl + group * DICT_GROUP);
+
+        if (match) {
+            return group * DICT_GROUP + __builtin_ctz(match);
         }
-        idx = (idx + 1) % dict->cap;
+        group = (group + ++step) & mask;
+    }
+}
+
+static
+void dict_put(tlisp_dict_t *dict, int idx, size_t hash, tlisp_obj_t *key, tlisp_obj_t *val)
+{
+    if (dict->ctrl[idx] == CTRL_EMPTY) {
+        dict->growth_left--;
     }
-    dict->entries[idx].key = key;
-    dict->entries[idx].val = val;
-    dict->entries[idx].valid = 1;
+    dict->ctrl[idx] = H2(hash);
+    DICT_KEYS(dict)[idx] = key;
+    DICT_VALS(dict)[idx] = val;
     dict->len++;
-    return NULL;
 }
 
 static
-tlisp_dict_entry_t *dict_get_internal(tlisp_dict_t *dict, tlisp_obj_t *key)
+void dict_resize(tlisp_dict_t *dict, int cap)
 {
-    size_t idx = obj_hash(key) % dict->cap;
+    tlisp_dict_t old = *dict;
+    tlisp_obj_t **keys = DICT_KEYS(&old);
+    tlisp_obj_t **vals = DICT_VALS(&old);
+    int i;
 
-     while (dict->entries[idx].key) {
-        if (dict->entries[idx].valid &&
-            obj_equals(dict->entries[idx].key, key)) {
-            
-            return dict->entries + idx;
+    dict_alloc(dict, cap);
+    for (i = 0; i < old.cap; i++) {
+        if (DICT_SLOT_FULL(&old, i)) {
+            size_t hash = obj_hash(keys[i]);
+            dict_put(dict, dict_find_free(dict, hash), hash, keys[i], vals[i]);
         }
-        idx = (idx + 1) % dict->cap;
-     }
-     return NULL;
+    }
+    pool_free(old.ctrl);
 }
 
+tlisp_obj_t *dict_ins(tlisp_dict_t *dict, tlisp_obj_t *key, tlisp_obj_t *val)
+{
+    size_t hash = obj_hash(key);
+    int idx = dict_find(dict, key, hash);
+
+    if (idx >= 0) {
+        tlisp_obj_t *old = DICT_VALS(dict)[idx];
+        DICT_VALS(dict)[idx] = val;
+        return old;
+    }
+    idx = dict_find_free(dict, hash);
+    if (dict->ctrl[idx] == CTRL_EMPTY && !dict->growth_left) {
+        // Out of empty slots. If tombstones are what used them up,
+        // rehashing at the same size is enough to reclaim them.
+        dict_resize(dict, dict->len < MAX_LOAD(dict->cap) / 2 ? dict->cap : dict->cap * 2);
+        idx = dict_find_free(dict, hash);
+    }
+    dict_put(dict, idx, hash, key, val);
+    return NULL;
+}
 
 tlisp_obj_t *dict_get(tlisp_dict_t *dict, tlisp_obj_t *key)
 {
-    tlisp_dict_entry_t *entry = dict_get_internal(dict, key);
-    return entry ? entry->val : NULL;
+    int idx = dict_find(dict, key, obj_hash(key));
+    return idx >= 0 ? DICT_VALS(dict)[idx] : NULL;
 }
 
 tlisp_obj_t *dict_rem(tlisp_dict_t *dict, tlisp_obj_t *key)
 {
-    tlisp_dict_entry_t *entry = dict_get_internal(dict, key);
-
-    if (!entry) return NULL;
-    
-    entry->valid = 0;
+    int idx = dict_find(dict, key, obj_hash(key));
+    tlisp_obj_t *val;
+
+    if (idx < 0) return NULL;
+
+    val = DICT_VALS(dict)[idx];
+    // A probe only moves past a group with no empty slots, so a slot
+    // in a group that still has one can be emptied outright.
+    if (group_match(dict->ctrl + idx / DICT_GROUP * DICT_GROUP, CTRL_EMPTY)) {
+        dict->ctrl[idx] = CTRL_EMPTY;
+        dict->growth_left++;
+    } else {
+        dict->ctrl[idx] = CTRL_DELETED;
+    }
     dict->len--;
     if (dict->cap >= 2 * MIN_CAP && dict->len < dict->cap / 4) {
         dict_resize(dict, dict->cap / 2);
     }
-    return entry->val;
+    return val;
 }
 
 int dict_len(tlisp_dict_t *dict)
@@ -103,11 +203,13 @@ int dict_len(tlisp_dict_t *dict)
 
 void dict_for_each(tlisp_dict_t *dict, dict_visitor fn, void *state)
 {
+    tlisp_obj_t **keys = DICT_KEYS(dict);
+    tlisp_obj_t **vals = DICT_VALS(dict);
     int i;
 
     for (i = 0; i < dict->cap; i++) {
-        if (dict->entries[i].valid) {
-            fn(dict->entries[i].key, dict->entries[i].val, state);
+        if (DICT_SLOT_FULL(dict, i)) {
+            fn(keys[i], vals[i], state);
         }
     }
 }
@@ -3,18 +3,23 @@
 
 typedef struct tlisp_obj_t tlisp_obj_t;
 
-typedef struct tlisp_dict_entry_t {
-    tlisp_obj_t *key;
-    tlisp_obj_t *val;
-    int valid;
-} tlisp_dict_entry_t;
+// A Swiss table. Each slot has a control byte that is either empty,
+// deleted, or the low seven bits of its key's hash, and lookups test
+// a group of sixteen control bytes at a time. The control bytes,
+// keys and values are separate arrays in a single block.
+#define DICT_GROUP 16
 
 typedef struct tlisp_dict_t {
     int len;
     int cap;
-    tlisp_dict_entry_t *entries;
+    int growth_left;   /* Empty slots usable before a rehash. */
+    signed char *ctrl;
 } tlisp_dict_t;
 
+#define DICT_KEYS(dict) ((tlisp_obj_t **)((dict)->ctrl + (dict)->cap))
+#define DICT_VALS(dict) (DICT_KEYS(dict) + (dict)->cap)
+#define DICT_SLOT_FULL(dict, i) ((dict)->ctrl[i] >= 0)
+
 typedef void (*dict_visitor)(tlisp_obj_t *key, tlisp_obj_t *val, void *);
 
 void dict_init(tlisp_dict_t *);
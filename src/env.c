@@ -1,121 +1,267 @@
-
 #include "env.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static
-size_t str_hash(const char *s)
-{
-    size_t hash = 5381;
-    while (*s) {
-        hash = (hash << 5) + hash + *s;
-        s++;
-    }
-    return hash;
-}
+#define MIN_GLOBALS_CAP 256
 
 static
-void env_grow(env_t *env)
+void globals_grow(globals_t *globals, int id)
 {
-    int i;
-    size_t old_cap = env->symtab.cap;
-    symtab_entry_t *old = env->symtab.entries;
-    
-    env->symtab.cap *= 2;
-    env->symtab.entries = calloc(env->symtab.cap, sizeof(symtab_entry_t));
-    for (i = 0; i < old_cap; i++) {
-        if (old[i].sym) {
-            env_add(env, old[i].sym, old[i].obj);
-        }
+    size_t cap = globals->cap;
+
+    while (cap <= id) {
+        cap *= 2;
     }
-    free(old);
+    globals->vals = realloc(globals->vals, sizeof(tlisp_obj_t *) * cap);
+    memset(globals->vals + globals->cap, 0, sizeof(tlisp_obj_t *) * (cap - globals->cap));
+    globals->cap = cap;
 }
 
 void env_init(env_t *env, env_t *outer, process_t *proc)
 {
-    env->symtab.len = 0;
-    env->symtab.cap = 16;
-    env->symtab.entries = calloc(env->symtab.cap, sizeof(symtab_entry_t));
+    if (!outer) {
+        env->globals.cap = MIN_GLOBALS_CAP;
+        env->globals.vals = calloc(env->globals.cap, sizeof(tlisp_obj_t *));
+        proc->genv = env;
+    }
+    env->nslots = 0;
+    env->slots_cap = ENV_INLINE_SLOTS;
+    env->slots = env->inline_slots;
+    env->names = 0;
     env->proc = proc;
     env->outer = outer;
+    proc_push_env(proc, env);
 }
 
 void env_destroy(env_t *env)
 {
-    free(env->symtab.entries);
+    int i;
+
+    proc_pop_env(env->proc, env);
+    if (!env->outer) {
+        free(env->globals.vals);
+        return;
+    }
+    for (i = 0; i < env->nslots; i++) {
+        env->slots[i].sym->sym_frames--;
+    }
+    if (env->slots != env->inline_slots) {
+        free(env->slots);
+    }
+}
+
+static
+void duplicate_symbol(tlisp_obj_t *sym)
+{
+    fprintf(stderr, "ERROR: Duplicate symbol definition %s.\n", sym->sym);
+    exit(1);
 }
 
-void env_add(env_t *env, const char *sym, tlisp_obj_t *obj)
+#define NAME_BIT(sym) ((uint64_t)1 << ((sym)->sym_hash & 63))
+
+// The slot sym is bound in, in env's frame alone, or -1.
+static
+int slot_of(env_t *env, tlisp_obj_t *sym)
 {
-    size_t hash = str_hash(sym);
-    size_t idx = hash % env->symtab.cap;
-    symtab_entry_t *entries = env->symtab.entries;
+    int i;
 
-    if (env->symtab.len >= ((env->symtab.cap * 3) / 4)) {
-        env_grow(env);
-        idx = hash % env->symtab.cap;
-        entries = env->symtab.entries;
+    if (!(env->names & NAME_BIT(sym))) {
+        return -1;
     }
-    while (entries[idx].sym) {
-        if (!strcmp(sym, entries[idx].sym)) {
-            fprintf(stderr, "ERROR: Duplicate symbol definition %s.\n", sym);
-            exit(1);
+    for (i = 0; i < env->nslots; i++) {
+        if (env->slots[i].sym == sym) {
+            return i;
         }
-        idx = (idx + 1) % env->symtab.cap;
     }
-    entries[idx].sym = sym;
-    entries[idx].obj = obj;
-    env->symtab.len++;
+    return -1;
 }
 
-symtab_entry_t *env_find_internal(env_t *env, const char *sym)
+static
+void frame_add(env_t *env, tlisp_obj_t *sym, tlisp_obj_t *obj)
 {
-    size_t hash = str_hash(sym);
-    
-    while (env) {
-        symtab_entry_t *entries = env->symtab.entries;
-        size_t idx = hash % env->symtab.cap;
-        
-        while (entries[idx].sym) {
-            if (!strcmp(entries[idx].sym, sym)) {
-                return &entries[idx];
+    if (slot_of(env, sym) >= 0) {
+        duplicate_symbol(sym);
+    }
+    if (env->nslots == env->slots_cap) {
+        symtab_entry_t *slots = malloc(sizeof(symtab_entry_t) * env->slots_cap * 2);
+        memcpy(slots, env->slots, sizeof(symtab_entry_t) * env->nslots);
+        if (env->slots != env->inline_slots) {
+            free(env->slots);
+        }
+        env->slots = slots;
+        env->slots_cap *= 2;
+    }
+    env->slots[env->nslots].sym = sym;
+    env->slots[env->nslots].obj = obj;
+    env->nslots++;
+    env->names |= NAME_BIT(sym);
+    sym->sym_frames++;
+}
+
+void env_add(env_t *env, tlisp_obj_t *sym, tlisp_obj_t *obj)
+{
+    globals_t *globals = &env->globals;
+
+    if (env->outer) {
+        frame_add(env, sym, obj);
+        return;
+    }
+    if (sym->sym_id >= globals->cap) {
+        globals_grow(globals, sym->sym_id);
+    }
+    if (globals->vals[sym->sym_id]) {
+        duplicate_symbol(sym);
+    }
+    globals->vals[sym->sym_id] = obj;
+}
+
+// Where sym's value is kept, as seen from env, or NULL if it's unbound.
+static
+tlisp_obj_t **env_find_internal(env_t *env, tlisp_obj_t *sym)
+{
+    tlisp_obj_t **val;
+
+    if (sym->sym_frames) {
+        for (; env->outer; env = env->outer) {
+            int i = slot_of(env, sym);
+
+            if (i >= 0) {
+                return &env->slots[i].obj;
             }
-            idx = (idx + 1) % env->symtab.cap;
         }
-        env = env->outer;
+    } else {
+        env = env->proc->genv;
     }
-    return NULL;
+    if (sym->sym_id >= env->globals.cap) {
+        return NULL;
+    }
+    val = &env->globals.vals[sym->sym_id];
+    return *val ? val : NULL;
 }
 
-tlisp_obj_t *env_find(env_t *env, const char *sym)
+tlisp_obj_t *env_find(env_t *env, tlisp_obj_t *sym)
 {
-    symtab_entry_t *entry = env_find_internal(env, sym);
-    return entry ? entry->obj : NULL;
+    tlisp_obj_t **val = env_find_internal(env, sym);
+    return val ? *val : NULL;
 }
 
-int env_update(env_t *env, const char *sym, tlisp_obj_t *obj)
+// Looks sym up in the slot it was resolved to. Scoping is dynamic,
+// so the frames at run time needn't be the ones the resolver saw:
+// the slot is only used if it holds sym and no nearer frame binds
+// it, which is just where env_find would have found it. Otherwise
+// returns NULL, and the caller falls back to env_find.
+tlisp_obj_t *env_find_slot(env_t *env, tlisp_obj_t *sym, int slot)
 {
-    symtab_entry_t *entry = env_find_internal(env, sym);
+    int depth = SLOT_DEPTH(slot);
+    int idx = SLOT_INDEX(slot);
 
-    if (!entry) return 0;
+    for (; depth > 0; depth--) {
+        if (!env->outer || slot_of(env, sym) >= 0) {
+            return NULL;
+        }
+        env = env->outer;
+    }
+    if (!env->outer || idx >= env->nslots || env->slots[idx].sym != sym) {
+        return NULL;
+    }
+    return env->slots[idx].obj;
+}
+
+int env_update(env_t *env, tlisp_obj_t *sym, tlisp_obj_t *obj)
+{
+    tlisp_obj_t **val = env_find_internal(env, sym);
 
-    entry->obj = obj;
+    if (!val) return 0;
+
+    *val = obj;
     return 1;
 }
 
+// Whether every name bound in outer is also bound in env, so that
+// nothing looked up through env can see outer's bindings.
+int env_shadows(env_t *env, env_t *outer)
+{
+    int i;
+
+    if (!env->outer || !outer->outer || (outer->names & ~env->names)) {
+        return 0;
+    }
+    for (i = 0; i < outer->nslots; i++) {
+        if (slot_of(env, outer->slots[i].sym) < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Replaces env's bindings with those in the frame with.
+void env_replace(env_t *env, env_t *with)
+{
+    int i;
+
+    for (i = 0; i < env->nslots; i++) {
+        env->slots[i].sym->sym_frames--;
+    }
+    if (env->slots_cap < with->nslots) {
+        if (env->slots != env->inline_slots) {
+            free(env->slots);
+        }
+        env->slots = malloc(sizeof(symtab_entry_t) * with->slots_cap);
+        env->slots_cap = with->slots_cap;
+    }
+    memcpy(env->slots, with->slots, sizeof(symtab_entry_t) * with->nslots);
+    env->nslots = with->nslots;
+    env->names = with->names;
+    for (i = 0; i < env->nslots; i++) {
+        env->slots[i].sym->sym_frames++;
+    }
+}
+
 void env_for_each(env_t *env, env_visitor fn, void *state)
 {
     while (env) {
-        symtab_entry_t *entries = env->symtab.entries;
-        int cap = env->symtab.cap;
-        int i;
+        env_for_each_local(env, fn, state);
+        env = env->outer;
+    }
+}
+
+void env_for_each_local(env_t *env, env_visitor fn, void *state)
+{
+    int i;
 
-        for (i = 0; i < cap; i++) {
-            if (entries[i].sym) {
-                fn(entries[i].obj, state);
+    if (env->outer) {
+        for (i = 0; i < env->nslots; i++) {
+            fn(env->slots[i].obj, state);
+        }
+        return;
+    }
+    for (i = 0; i < env->globals.cap; i++) {
+        if (env->globals.vals[i]) {
+            fn(env->globals.vals[i], state);
+        }
+    }
+}
+
+// The slot sym would be found in by code run in scope, or 0 if it
+// isn't bound there, or only by a frame whose names aren't known.
+int scope_find(scope_t *scope, tlisp_obj_t *sym)
+{
+    int depth = 0;
+    tlisp_obj_t *names;
+    int idx;
+
+    for (; scope && depth <= SLOT_MAX_DEPTH; scope = scope->outer, depth++) {
+        idx = 0;
+        for (names = scope->names; names; names = names->cdr) {
+            if (names->car == sym) {
+                return idx <= SLOT_MAX_INDEX ? SLOT_PACK(depth, idx) : 0;
             }
+            if (scope->step == 2 && !(names = names->cdr)) {
+                break;
+            }
+            idx++;
         }
-        env = env->outer;
     }
+    return 0;
 }
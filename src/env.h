@@ -3,31 +3,74 @@
 
 #include "core.h"
 #include "process.h"
+#include <stdint.h>
 
+// Keyed on interned symbols, so lookups compare pointers.
 typedef struct symtab_entry_t {
-    const char *sym;
+    tlisp_obj_t *sym;
     tlisp_obj_t *obj;
 } symtab_entry_t;
 
-typedef struct symtab_t {
-    size_t len;
+// The global env is a table of values indexed by sym_id, NULL where
+// a symbol's unbound. A name no frame binds (sym_frames is 0) needs
+// no search at all: it can only be global, and is a load away.
+typedef struct globals_t {
     size_t cap;
-    symtab_entry_t *entries;
-} symtab_t;
+    tlisp_obj_t **vals;
+} globals_t;
+
+// Every other env is a frame: its names are bound in slots, in the
+// order they're added, and the first ENV_INLINE_SLOTS live in the env
+// itself, so that a call or let can make one without allocating.
+#define ENV_INLINE_SLOTS 6
 
 typedef struct env_t {
-    symtab_t symtab;
+    union {
+        globals_t globals;
+        symtab_entry_t inline_slots[ENV_INLINE_SLOTS];
+    };
+    int nslots;
+    int slots_cap;
+    symtab_entry_t *slots;
+    uint64_t names;     // A bit per name bound, by hash, to skip frames fast
     process_t *proc;
     struct env_t *outer;
 } env_t;
 
+// The names a frame is known to bind before anything runs in it: a
+// lambda's parameters (step 1) or a let's bindings (step 2). A scope
+// with no names stands for a frame whose names can't be known, like
+// the one a lambda's arguments are evaluated in.
+typedef struct scope_t {
+    tlisp_obj_t *names;
+    int step;
+    struct scope_t *outer;
+} scope_t;
+
+// A local resolved to the idx'th slot of the frame depth envs out,
+// packed to fit a cons's ic_idx. 0 means unresolved. A depth of 15
+// instead marks the name of a special form, numbered by the builtins.
+#define SLOT_MAX_DEPTH 14
+#define SLOT_MAX_INDEX 4094
+#define SLOT_PACK(depth, idx) ((depth) << 12 | ((idx) + 1))
+#define SLOT_DEPTH(slot) ((slot) >> 12)
+#define SLOT_INDEX(slot) (((slot) & 0xfff) - 1)
+#define SLOT_SPECIAL(form) (0xf000 | (form))
+#define SLOT_IS_SPECIAL(slot) (SLOT_DEPTH(slot) == 0xf)
+#define SLOT_SPECIAL_FORM(slot) ((slot) & 0xfff)
+
 typedef void (*env_visitor)(tlisp_obj_t *, void *);
 
 void env_init(env_t *, env_t *outer, process_t *);
 void env_destroy(env_t *); 
-void env_add(env_t *, const char *sym, tlisp_obj_t *);
-tlisp_obj_t *env_find(env_t *, const char *sym);
-int env_update(env_t *, const char *sym, tlisp_obj_t *);
+void env_add(env_t *, tlisp_obj_t *sym, tlisp_obj_t *);
+tlisp_obj_t *env_find(env_t *, tlisp_obj_t *sym);
+tlisp_obj_t *env_find_slot(env_t *, tlisp_obj_t *sym, int slot);
+int env_update(env_t *, tlisp_obj_t *sym, tlisp_obj_t *);
+int env_shadows(env_t *, env_t *outer);
+void env_replace(env_t *, env_t *with);
 void env_for_each(env_t *, env_visitor, void *);
+void env_for_each_local(env_t *, env_visitor, void *);
+int scope_find(scope_t *, tlisp_obj_t *sym);
 
 #endif
@@ -1,82 +1,335 @@
 
 #include "gc.h"
+#include "arena.h"
 #include "dict.h"
+#include "heap.h"
+#include "pool.h"
 #include "process.h"
+#include "strbuf.h"
 #include "vector.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-static char ALIVE = 1;
+// Marks are sticky between minor collections: an object whose mark
+// bit is set has survived a collection and belongs to the old
+// generation, while freshly allocated objects start out unmarked.
+//
+// Marking is driven by explicit mark stacks rather than by recursion,
+// so deeply nested structures can't overflow the C stack. During an
+// incremental cycle objects are tri-colored: white objects aren't
+// marked, gray ones are marked and on the mark stack, and black ones
+// are marked and have had their children shaded.
+static int MINOR = 0;
+static int PARALLEL = 0;
 
-static void gc_mark(tlisp_obj_t *, void *);
+#define MARK_CHUNK 256 /* Elements scanned per mark stack entry. */
+#define PREFETCH_DIST 8
+#define STEAL_BATCH 64 /* Entries a worker hands over to thieves at once. */
+#define SWEEP_BATCH 8 /* Pages a sweep worker claims at once. */
+#define PARALLEL_MIN_PAGES 64 /* Heap size before workers are worth it. */
+
+// A parallel GC worker. Each one marks from a private stack and
+// publishes a batch of entries to its shared stack when it has work
+// to spare; idle workers steal from the shared stacks.
+typedef struct gc_worker_t {
+    mark_stack_t stack;
+    pthread_mutex_t lock;
+    int nshared;
+    mark_entry_t shared[STEAL_BATCH];
+    size_t nalive;
+    size_t nfreed;
+    size_t freed[NUM_TAGS];
+    int id;
+    pthread_t thread;
+} gc_worker_t;
+
+static gc_worker_t *workers = NULL;
+static int nworkers = 0;
+static int nidle = 0;
+static int go = 0;
+static heap_page_t **sweep_pages = NULL;
+static size_t nsweep_pages = 0;
+static size_t sweep_next = 0;
 
 static
-void gc_mark_dict(tlisp_obj_t *key, tlisp_obj_t *val, void *procptr)
+int gc_mark_obj(tlisp_obj_t *obj, mark_stack_t *ms)
 {
-    gc_mark(key, procptr);
-    gc_mark(val, procptr);
+    // Objects outside the heap (the reader's output and the
+    // builtins) are never collected, but may still point at
+    // heap objects. A full collection traces through them; a
+    // minor one treats them as old and relies on the write
+    // barrier instead.
+    heap_page_t *page = heap_page_of(&ms->proc->heap, obj);
+    size_t idx;
+    uint64_t *word;
+
+    if (!page) {
+        if (!MINOR && obj->in_arena) {
+            __atomic_store_n(&arena_of(obj)->live, 1, __ATOMIC_RELAXED);
+        }
+        return !MINOR;
+    }
+    idx = HEAP_OBJ_INDEX(page, obj);
+    word = page->marks + idx / 64;
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & HEAP_BIT(idx)) {
+        return 0;
+    }
+    if (PARALLEL) {
+        if (__atomic_fetch_or(word, HEAP_BIT(idx), __ATOMIC_RELAXED) & HEAP_BIT(idx)) {
+            return 0;
+        }
+    } else {
+        *word |= HEAP_BIT(idx);
+    }
+    (*ms->nalive)++;
+    return 1;
 }
 
 static
-void gc_mark(tlisp_obj_t *obj, void *procptr)
+void mark_push(mark_stack_t *ms, tlisp_obj_t *obj, int idx)
 {
-    process_t *proc = (process_t *)procptr;
-    
-    if (obj->mark == ALIVE) 
-        return;
+    if (ms->len == ms->cap) {
+        mark_entry_t *entries = NULL;
+
+        if (ms->cap < MARK_STACK_MAX) {
+            entries = realloc(ms->entries, sizeof(mark_entry_t) * ms->cap * 2);
+        }
+
+        // Out of room. The object stays marked but unscanned, and
+        // mark_recover picks it up once the stack has drained.
+        if (!entries) {
+            ms->overflow = 1;
+            return;
+        }
+        ms->entries = entries;
+        ms->cap *= 2;
+    }
+    __builtin_prefetch(obj);
+    ms->entries[ms->len].obj = obj;
+    ms->entries[ms->len].idx = idx;
+    ms->len++;
+}
+
+static
+void gc_mark(tlisp_obj_t *obj, void *msptr)
+{
+    mark_stack_t *ms = (mark_stack_t *)msptr;
+
+    if (obj && !IS_FIXNUM(obj) && gc_mark_obj(obj, ms)) {
+        mark_push(ms, obj, 0);
+    }
+}
+
+static
+void scan_vec(mark_stack_t *ms, tlisp_obj_t *obj, int idx)
+{
+    tlisp_vector_t *vec = &obj->vec;
+    int end = idx + MARK_CHUNK;
+    int i;
+
+    if (end < vec->len) {
+        mark_push(ms, obj, end);
+    } else {
+        end = vec->len;
+    }
+    for (i = idx; i < end; i++) {
+        if (i + PREFETCH_DIST < end) {
+            __builtin_prefetch(vec->elems[i + PREFETCH_DIST]);
+        }
+        gc_mark(vec->elems[i], ms);
+    }
+}
+
+static
+void scan_dict(mark_stack_t *ms, tlisp_obj_t *obj, int idx)
+{
+    tlisp_dict_t *dict = &obj->dict;
+    tlisp_obj_t **keys;
+    tlisp_obj_t **vals;
+    int end = idx + MARK_CHUNK;
+    int i;
+
+    if (end < dict->cap) {
+        mark_push(ms, obj, end);
+    } else {
+        end = dict->cap;
+    }
+    keys = DICT_KEYS(dict);
+    vals = DICT_VALS(dict);
+    for (i = idx; i < end; i++) {
+        if (i + PREFETCH_DIST < end && DICT_SLOT_FULL(dict, i + PREFETCH_DIST)) {
+            __builtin_prefetch(keys[i + PREFETCH_DIST]);
+            __builtin_prefetch(vals[i + PREFETCH_DIST]);
+        }
+        if (DICT_SLOT_FULL(dict, i)) {
+            gc_mark(keys[i], ms);
+            gc_mark(vals[i], ms);
+        }
+    }
+}
+
+static
+void scan_list(mark_stack_t *ms, tlisp_obj_t *obj)
+{
+    int n;
 
-    obj->mark = ALIVE;
-    proc->nalive++;
-    switch (obj->tag) {
+    // Lambdas and macros hold their argument list and body in car
+    // and cdr. Walk the spine in place, handing the rest back to
+    // the stack every MARK_CHUNK cells so a single entry can't
+    // blow an incremental pause.
+    for (n = 0; n < MARK_CHUNK; n++) {
+        tlisp_obj_t *next = obj->cdr;
+
+        gc_mark(obj->car, ms);
+        if (!next || IS_FIXNUM(next) || !gc_mark_obj(next, ms)) {
+            return;
+        }
+        if (OBJ_TAG(next) != CONS) {
+            mark_push(ms, next, 0);
+            return;
+        }
+        obj = next;
+    }
+    mark_push(ms, obj, 0);
+}
+
+static
+void gc_scan(mark_stack_t *ms, tlisp_obj_t *obj, int idx)
+{
+    switch (OBJ_TAG(obj)) {
     case BOOL:
     case NUM:
+    case FLOAT:
     case STRING:
+    case STRBUILDER:
     case NFUNC:
     case NIL:
     case SYMBOL:
     case STRUCTDEF:
         return;
-    case LAMBDA:
-    case MACRO:
-        
-        // In lambda and macro's case, assume symbols and forms
-        // were allocated by the reader outside the context
-        // of the process.
-        return;
     case STRUCT: {
         int nfields = obj->structobj.sdef->nfields;
         int i;
 
-        /* TODO: Don't mark unless we know the associated structdef is in scope. */
-
+        // A struct's sdef points into its structdef object,
+        // which starts with the structdef payload.
+        gc_mark((tlisp_obj_t *)obj->structobj.sdef, ms);
         for (i = 0; i < nfields; i++) {
-            gc_mark(obj->structobj.fields[i], proc);
+            gc_mark(obj->structobj.fields[i], ms);
         }
         return;
     }
+    case LAMBDA:
+    case MACRO:
+        gc_mark(obj->car, ms);
+        gc_mark(obj->cdr, ms);
+        return;
     case CONS:
-        gc_mark(obj->car, proc);
-        while ((obj = obj->cdr)) {
-            obj->mark = ALIVE;
-            proc->nalive++;
-            gc_mark(obj->car, proc);
-        }
+        scan_list(ms, obj);
         return;
     case DICT:
-        dict_for_each(&obj->dict, gc_mark_dict, proc);
+        scan_dict(ms, obj, idx);
         return;
     case VEC:
-        vec_for_each(&obj->vec, gc_mark, proc);
+        scan_vec(ms, obj, idx);
+        return;
+    }
+}
+
+static
+void mark_recover(mark_stack_t *ms)
+{
+    heap_page_t *page;
+    size_t i;
+
+    // Rescan everything that's marked. Anything dropped on
+    // overflow is marked, so its children get shaded here.
+    ms->overflow = 0;
+    for (page = ms->proc->heap.pages; page; page = page->next) {
+        for (i = 0; i < HEAP_BITMAP_WORDS; i++) {
+            uint64_t bits = page->marks[i] & page->allocs[i];
+
+            while (bits) {
+                gc_scan(ms, HEAP_OBJ_AT(page, i * 64 + __builtin_ctzll(bits)), 0);
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+// Compact objects have no header, so their remembered bit lives in
+// their page.
+static
+int is_remembered(process_t *proc, tlisp_obj_t *obj)
+{
+    heap_page_t *page;
+    size_t idx;
+
+    if (!IS_COMPACT(obj)) {
+        return obj->remembered;
+    }
+    page = heap_page_of(&proc->heap, obj);
+    idx = HEAP_OBJ_INDEX(page, obj);
+    return (page->remembered[idx / 64] & HEAP_BIT(idx)) != 0;
+}
+
+static
+void set_remembered(process_t *proc, tlisp_obj_t *obj, int val)
+{
+    heap_page_t *page;
+    size_t idx;
+
+    if (!IS_COMPACT(obj)) {
+        obj->remembered = val;
         return;
     }
+    page = heap_page_of(&proc->heap, obj);
+    idx = HEAP_OBJ_INDEX(page, obj);
+    if (val) {
+        page->remembered[idx / 64] |= HEAP_BIT(idx);
+    } else {
+        page->remembered[idx / 64] &= ~HEAP_BIT(idx);
+    }
+}
+
+// A list cell is remembered itself, not its list, so scanning it
+// stops at the first cell down the spine that's already marked.
+static
+void gc_mark_remembered(tlisp_obj_t *obj, mark_stack_t *ms)
+{
+    set_remembered(ms->proc, obj, 0);
+    gc_scan(ms, obj, 0);
+}
+
+static
+void gc_mark_roots(mark_stack_t *ms, int first, int step)
+{
+    process_t *proc = ms->proc;
+    int i;
+
+    for (i = first; i < proc->nenvs; i += step) {
+        env_for_each_local(proc->envs[i], gc_mark, ms);
+    }
+    for (i = first; i < proc->nroots; i += step) {
+        gc_mark(*proc->roots[i], ms);
+    }
+    for (i = first; i < proc->vm_sp; i += step) {
+        gc_mark(proc->vm_stack[i], ms);
+    }
 }
 
 static
 void free_obj(tlisp_obj_t *obj)
 {
-    switch (obj->tag) {
+    switch (OBJ_TAG(obj)) {
     case BOOL:
     case NUM:
+    case FLOAT:
     case NFUNC:
     case NIL:
     case LAMBDA:
@@ -96,7 +349,10 @@ void free_obj(tlisp_obj_t *obj)
         vec_destroy(&obj->vec);
         return;
     case STRING:
-        free(obj->str);
+        pool_free(obj->str);
+        return;
+    case STRBUILDER:
+        strbuf_destroy(&obj->strbuf);
         return;
     case SYMBOL:
         free(obj->sym);
@@ -105,37 +361,687 @@ void free_obj(tlisp_obj_t *obj)
 }
 
 static
-void heap_shrink(process_t *proc)
+uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static
+size_t sweep_bits(heap_page_t *page, size_t *freed)
+{
+    size_t nfreed = 0;
+    size_t i;
+
+    // Work a bitmap word at a time: only dead objects, which may
+    // own out-of-line payloads, are ever touched. Live ones stay
+    // allocated, and everything else becomes free.
+    page->nalive = 0;
+    for (i = 0; i < HEAP_BITMAP_WORDS; i++) {
+        uint64_t dead = page->allocs[i] & ~page->marks[i];
+
+        // Compact cells own nothing and have no header to read.
+        if (page->tag >= 0) {
+            freed[page->tag] += page->obj_size * __builtin_popcountll(dead);
+            nfreed += __builtin_popcountll(dead);
+            dead = 0;
+        }
+        while (dead) {
+            tlisp_obj_t *obj = HEAP_OBJ_AT(page, i * 64 + __builtin_ctzll(dead));
+
+            freed[obj->tag] += page->obj_size;
+            free_obj(obj);
+            nfreed++;
+            dead &= dead - 1;
+        }
+        page->allocs[i] = page->marks[i];
+        page->remembered[i] &= page->marks[i];
+        page->nalive += __builtin_popcountll(page->marks[i]);
+    }
+    return nfreed;
+}
+
+static
+void sweep_page(process_t *proc, heap_page_t *page)
+{
+    proc->heap_len -= sweep_bits(page, proc->gc_stats.cycle_freed);
+    heap_page_swept(&proc->heap, page);
+}
+
+static
+void nursery_sweep(process_t *proc)
+{
+    heap_t *heap = &proc->heap;
+    size_t i;
+
+    // Only pages allocated into since the last collection can
+    // hold young objects. Old ones are marked and left alone.
+    for (i = 0; i < heap->nyoung; i++) {
+        sweep_page(proc, heap->young[i]);
+    }
+    heap_reset_young(heap);
+    proc->heap_cap = heap->npages * HEAP_PAGE_OBJS;
+}
+
+static
+void start_cycle(process_t *proc)
 {
-    tlisp_obj_t *heap;
-    int len = 0;
     int i;
 
-    proc->heap_cap = proc->nalive * 2;
-    heap = malloc(sizeof(tlisp_obj_t) * proc->heap_cap);
-    for (i = 0; i < proc->heap_len; i++) {
-        if (proc->heap[i].mark == ALIVE) {
-            memcpy(heap + len, proc->heap + i, sizeof(tlisp_obj_t));
-            len++;
+    // Clearing the mark bits turns every old object white again.
+    // A full collection retraces everything, so the remembered
+    // set and the young/old split start over.
+    arena_t *arena;
+
+    heap_clear_marks(&proc->heap);
+    MINOR = 0;
+    proc->nalive = 0;
+    for (arena = proc->arenas; arena; arena = arena->next) {
+        arena->live = 0;
+    }
+    for (i = 0; i < proc->nremembered; i++) {
+        set_remembered(proc, proc->remembered[i], 0);
+    }
+    proc->nremembered = 0;
+    heap_reset_young(&proc->heap);
+}
+
+size_t gc_min_threshold(process_t *proc)
+{
+    size_t init = proc->heap.init_pages * HEAP_PAGE_OBJS;
+    return init > MIN_GC_THRESHOLD ? init : MIN_GC_THRESHOLD;
+}
+
+static
+void finish_cycle(process_t *proc)
+{
+    size_t threshold = proc->nalive * proc->gc_growth;
+
+    proc->gc_phase = GC_IDLE;
+    heap_reset_young(&proc->heap);
+    proc->heap_cap = proc->heap.npages * HEAP_PAGE_OBJS;
+
+    // Budget the next full collection by the size of the live set
+    // so that the cost of marking is amortized over allocations.
+    // The heap is never budgeted below its initial size.
+    proc->nallocs = 0;
+    proc->gc_stats.nfull++;
+    proc->gc_threshold = threshold > gc_min_threshold(proc) ?
+        threshold : gc_min_threshold(proc);
+}
+
+static
+int mark_drain(mark_stack_t *ms, uint64_t deadline)
+{
+    int n = 0;
+
+    for (;;) {
+        while (ms->len) {
+            mark_entry_t entry;
+
+            ms->len--;
+            entry = ms->entries[ms->len];
+            if (ms->len) {
+                __builtin_prefetch(ms->entries[ms->len - 1].obj);
+            }
+            gc_scan(ms, entry.obj, entry.idx);
+            n++;
+            if (deadline && n % 64 == 0 && now_us() >= deadline) {
+                return 0;
+            }
+        }
+        if (!ms->overflow) {
+            return 1;
+        }
+        mark_recover(ms);
+    }
+}
+
+static
+void free_arenas(process_t *proc)
+{
+    arena_t **link = &proc->arenas;
+
+    // Marking flags every arena it finds reader objects in.
+    // Released sources it didn't reach are garbage as a whole.
+    while (*link) {
+        arena_t *arena = *link;
+
+        if (arena->live) {
+            link = &arena->next;
         } else {
-            free_obj(proc->heap + i);
+            *link = arena->next;
+            proc->arena_bytes -= arena->size;
+            arena_destroy(arena);
         }
     }
-    free(proc->heap);
-    proc->heap = heap;
-    proc->heap_len = len;
+    proc->arena_threshold = proc->arena_bytes * proc->gc_growth;
+    if (proc->arena_threshold < MIN_ARENA_THRESHOLD) {
+        proc->arena_threshold = MIN_ARENA_THRESHOLD;
+    }
 }
 
-void gc(env_t *env)
+static
+void mark_finish(process_t *proc)
 {
-    process_t *proc = env->proc;
+    int i;
 
-    proc->nalive = 0;
-    env_for_each(env, gc_mark, env->proc);
-    if (proc->nalive < (proc->heap_len / 4) &&
-        (proc->nalive * sizeof(tlisp_obj_t) * 2) >= MIN_HEAP_SIZE) {
-        
-        heap_shrink(proc);
+    // Envs and the shadow stack aren't covered by the write
+    // barrier, so rescan them before declaring marking done. So
+    // too the collections whose elements moved or were unlinked
+    // since marking started: an element shifted behind a partly
+    // scanned chunk, or spliced onto an already scanned cell,
+    // would otherwise be missed.
+    gc_mark_roots(&proc->mark_stack, 0, 1);
+    for (i = 0; i < proc->nremembered; i++) {
+        gc_mark_remembered(proc->remembered[i], &proc->mark_stack);
+    }
+    proc->nremembered = 0;
+    mark_drain(&proc->mark_stack, 0);
+    free_arenas(proc);
+    proc->gc_phase = GC_SWEEPING;
+    heap_reset_avail(&proc->heap);
+}
+
+static
+void wait_to_start(void)
+{
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+}
+
+static
+void publish(gc_worker_t *w)
+{
+    mark_stack_t *ms = &w->stack;
+
+    // Hand the oldest entries, which tend to root the biggest
+    // subgraphs, to whoever comes looking for work.
+    if (ms->len < 2 * STEAL_BATCH || __atomic_load_n(&w->nshared, __ATOMIC_RELAXED)) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    if (!w->nshared) {
+        memcpy(w->shared, ms->entries, sizeof(mark_entry_t) * STEAL_BATCH);
+        memmove(ms->entries, ms->entries + STEAL_BATCH,
+                sizeof(mark_entry_t) * (ms->len - STEAL_BATCH));
+        ms->len -= STEAL_BATCH;
+        __atomic_store_n(&w->nshared, STEAL_BATCH, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static
+int steal_from(gc_worker_t *w, gc_worker_t *victim)
+{
+    int i;
+    int n;
+
+    if (!__atomic_load_n(&victim->nshared, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    pthread_mutex_lock(&victim->lock);
+    n = victim->nshared;
+    for (i = 0; i < n; i++) {
+        mark_push(&w->stack, victim->shared[i].obj, victim->shared[i].idx);
+    }
+    __atomic_store_n(&victim->nshared, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+    return n;
+}
+
+static
+int steal(gc_worker_t *w)
+{
+    int i;
+
+    // Take back our own batch first, then go round the others.
+    for (i = 0; i < nworkers; i++) {
+        if (steal_from(w, workers + (w->id + i) % nworkers)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static
+int work_left(void)
+{
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        if (__atomic_load_n(&workers[i].nshared, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static
+void *mark_worker(void *wptr)
+{
+    gc_worker_t *w = (gc_worker_t *)wptr;
+    int n = 0;
+
+    wait_to_start();
+    gc_mark_roots(&w->stack, w->id, nworkers);
+    for (;;) {
+        while (w->stack.len) {
+            w->stack.len--;
+            gc_scan(&w->stack, w->stack.entries[w->stack.len].obj,
+                    w->stack.entries[w->stack.len].idx);
+            if (++n % 64 == 0) {
+                publish(w);
+            }
+        }
+        if (steal(w)) {
+            continue;
+        }
+
+        // A worker only goes idle with its own shared batch empty,
+        // and only the owner ever refills it. So once every worker
+        // is idle, there's nothing left anywhere.
+        __atomic_add_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&nidle, __ATOMIC_SEQ_CST) == nworkers) {
+                return NULL;
+            }
+            if (work_left()) {
+                __atomic_sub_fetch(&nidle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static
+void *sweep_worker(void *wptr)
+{
+    gc_worker_t *w = (gc_worker_t *)wptr;
+
+    wait_to_start();
+    for (;;) {
+        size_t start = __atomic_fetch_add(&sweep_next, SWEEP_BATCH, __ATOMIC_RELAXED);
+        size_t end = start + SWEEP_BATCH;
+        size_t i;
+
+        if (start >= nsweep_pages) {
+            return NULL;
+        }
+        if (end > nsweep_pages) {
+            end = nsweep_pages;
+        }
+        for (i = start; i < end; i++) {
+            w->nfreed += sweep_bits(sweep_pages[i], w->freed);
+        }
+    }
+}
+
+static
+void run_workers(void *(*fn)(void *))
+{
+    int n = nworkers;
+    int i;
+
+    // The calling thread doubles as worker 0. Nobody starts until
+    // every thread is up, so if one can't be created the rest
+    // just carry on without it.
+    go = 0;
+    for (i = 1; i < n; i++) {
+        if (pthread_create(&workers[i].thread, NULL, fn, workers + i)) {
+            break;
+        }
+    }
+    nworkers = i;
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    fn(workers);
+    for (i = 1; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    nworkers = n;
+}
+
+static
+void init_workers(process_t *proc)
+{
+    int i;
+
+    if (nworkers != proc->gc_threads) {
+        workers = realloc(workers, sizeof(gc_worker_t) * proc->gc_threads);
+        for (i = nworkers; i < proc->gc_threads; i++) {
+            workers[i].stack.cap = 256;
+            workers[i].stack.entries = malloc(sizeof(mark_entry_t) * workers[i].stack.cap);
+            pthread_mutex_init(&workers[i].lock, NULL);
+        }
+        nworkers = proc->gc_threads;
+    }
+    for (i = 0; i < nworkers; i++) {
+        workers[i].stack.proc = proc;
+        workers[i].stack.nalive = &workers[i].nalive;
+        workers[i].stack.len = 0;
+        workers[i].stack.overflow = 0;
+        workers[i].nshared = 0;
+        workers[i].nalive = 0;
+        workers[i].nfreed = 0;
+        workers[i].id = i;
+    }
+}
+
+static
+void parallel_mark(process_t *proc)
+{
+    int i;
+
+    init_workers(proc);
+    nidle = 0;
+    PARALLEL = 1;
+    run_workers(mark_worker);
+    PARALLEL = 0;
+
+    // An overflowing worker dropped entries that are marked but
+    // unscanned. Recovering them is rare, so do it on one thread.
+    for (i = 0; i < nworkers; i++) {
+        proc->nalive += workers[i].nalive;
+        proc->mark_stack.overflow |= workers[i].stack.overflow;
+    }
+}
+
+static
+void parallel_sweep(process_t *proc)
+{
+    heap_page_t *page;
+    size_t i;
+    int tag;
+
+    // The heap's page lists aren't thread-safe, so the workers
+    // only sweep bitmaps and free payloads. Pages are then
+    // released or made available for allocation here.
+    sweep_pages = realloc(sweep_pages, sizeof(heap_page_t *) * proc->heap.npages);
+    nsweep_pages = 0;
+    for (page = proc->heap.pages; page; page = page->next) {
+        sweep_pages[nsweep_pages++] = page;
+    }
+    sweep_next = 0;
+    for (i = 0; i < nworkers; i++) {
+        workers[i].nfreed = 0;
+        memset(workers[i].freed, 0, sizeof(workers[i].freed));
+    }
+    pool_set_concurrent(1);
+    run_workers(sweep_worker);
+    pool_set_concurrent(0);
+    for (i = 0; i < nworkers; i++) {
+        proc->heap_len -= workers[i].nfreed;
+        for (tag = 0; tag < NUM_TAGS; tag++) {
+            proc->gc_stats.cycle_freed[tag] += workers[i].freed[tag];
+        }
+    }
+    for (i = 0; i < nsweep_pages; i++) {
+        heap_page_swept(&proc->heap, sweep_pages[i]);
+    }
+}
+
+static
+void gc_step(process_t *proc)
+{
+    uint64_t deadline = now_us() + proc->gc_pause_us;
+
+    if (proc->gc_phase == GC_MARKING) {
+        if (!mark_drain(&proc->mark_stack, deadline)) {
+            return;
+        }
+
+        mark_finish(proc);
+        proc->sweep_cursor = proc->heap.pages;
+    }
+    while (proc->sweep_cursor) {
+        heap_page_t *page = proc->sweep_cursor;
+
+        proc->sweep_cursor = page->next;
+        sweep_page(proc, page);
+        if (proc->sweep_cursor && now_us() >= deadline) {
+            return;
+        }
+    }
+    finish_cycle(proc);
+}
+
+void gc(process_t *proc)
+{
+    heap_page_t *page;
+    int parallel = proc->gc_threads > 1 &&
+        proc->heap.npages >= PARALLEL_MIN_PAGES;
+
+    // Finish any incremental cycle in progress in one go. Its
+    // marks are still good, so only the roots need rescanning.
+    if (proc->gc_phase == GC_IDLE) {
+        start_cycle(proc);
+        if (parallel) {
+            parallel_mark(proc);
+        }
+    }
+    proc->gc_phase = GC_MARKING;
+    mark_finish(proc);
+    if (parallel && !proc->sweep_cursor) {
+        parallel_sweep(proc);
+    } else {
+        page = proc->sweep_cursor ? proc->sweep_cursor : proc->heap.pages;
+        while (page) {
+            heap_page_t *next = page->next;
+            sweep_page(proc, page);
+            page = next;
+        }
+    }
+    proc->sweep_cursor = NULL;
+    finish_cycle(proc);
+}
+
+static
+void begin_collection(process_t *proc, const char *kind)
+{
+    gc_stats_t *stats = &proc->gc_stats;
+
+    stats->cycle_kind = kind;
+    stats->cycle_us = 0;
+    stats->cycle_heap_len = proc->heap_len;
+    memset(stats->cycle_freed, 0, sizeof(stats->cycle_freed));
+}
+
+void gc_minor(process_t *proc)
+{
+    int i;
+
+    if (proc->nalive >= proc->gc_threshold) {
+        if (!proc->gc_pause_us) {
+            begin_collection(proc, "full");
+            gc(proc);
+            return;
+        }
+        begin_collection(proc, "incremental");
+        start_cycle(proc);
+        proc->gc_phase = GC_MARKING;
+        gc_mark_roots(&proc->mark_stack, 0, 1);
+        proc->nallocs = 0;
+        gc_step(proc);
+        return;
+    }
+
+    // Survivors are marked and so promoted in place. Marking
+    // stops at old objects, so the work done is proportional to
+    // the roots, the remembered set and the survivors.
+    begin_collection(proc, "minor");
+    proc->gc_stats.nminor++;
+    MINOR = 1;
+    gc_mark_roots(&proc->mark_stack, 0, 1);
+    for (i = 0; i < proc->nremembered; i++) {
+        gc_mark_remembered(proc->remembered[i], &proc->mark_stack);
+    }
+    proc->nremembered = 0;
+    mark_drain(&proc->mark_stack, 0);
+    nursery_sweep(proc);
+    MINOR = 0;
+    proc->nallocs = 0;
+}
+
+static
+void trace_collection(process_t *proc)
+{
+    gc_stats_t *stats = &proc->gc_stats;
+    struct timespec ts;
+    int tag;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(proc->gc_trace, "gc %ld.%06ld %s %lluus heap %zu->%zu alive %zu freed",
+            (long)ts.tv_sec, ts.tv_nsec / 1000, stats->cycle_kind,
+            (unsigned long long)stats->cycle_us, stats->cycle_heap_len,
+            proc->heap_len, proc->nalive);
+    for (tag = 0; tag < NUM_TAGS; tag++) {
+        if (stats->cycle_freed[tag]) {
+            fprintf(proc->gc_trace, " %s=%zu", tag_str(tag), stats->cycle_freed[tag]);
+        }
+    }
+    fprintf(proc->gc_trace, "\n");
+    fflush(proc->gc_trace);
+}
+
+static
+void end_pause(process_t *proc, uint64_t start)
+{
+    gc_stats_t *stats = &proc->gc_stats;
+    uint64_t pause = now_us() - start;
+
+    stats->pause_total_us += pause;
+    if (pause > stats->pause_max_us) {
+        stats->pause_max_us = pause;
+    }
+
+    // An incremental collection spans several pauses and is only
+    // logged once its last slice has run.
+    stats->cycle_us += pause;
+    if (proc->gc_trace && proc->gc_phase == GC_IDLE) {
+        trace_collection(proc);
+    }
+}
+
+void gc_poll(process_t *proc)
+{
+    uint64_t start;
+
+    if (proc->gc_phase != GC_IDLE) {
+        if (proc->nallocs >= GC_SLICE_SIZE) {
+            proc->nallocs = 0;
+            start = now_us();
+            gc_step(proc);
+            end_pause(proc, start);
+        }
+        return;
+    }
+    if (proc->nallocs >= NURSERY_SIZE) {
+        start = now_us();
+        gc_minor(proc);
+        end_pause(proc, start);
+    }
+}
+
+void gc_collect(process_t *proc)
+{
+    uint64_t start = now_us();
+
+    begin_collection(proc, "full");
+    gc(proc);
+    end_pause(proc, start);
+}
+
+void gc_tag_bytes(process_t *proc, size_t *bytes)
+{
+    heap_page_t *page;
+    size_t i;
+
+    // Allocated objects, live or not yet swept, by tag.
+    memset(bytes, 0, sizeof(size_t) * NUM_TAGS);
+    for (page = proc->heap.pages; page; page = page->next) {
+        for (i = 0; i < HEAP_BITMAP_WORDS; i++) {
+            uint64_t bits = page->allocs[i];
+
+            if (page->tag >= 0) {
+                bytes[page->tag] += page->obj_size * __builtin_popcountll(bits);
+                continue;
+            }
+            while (bits) {
+                bytes[HEAP_OBJ_AT(page, i * 64 + __builtin_ctzll(bits))->tag] += page->obj_size;
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+void gc_init_obj(process_t *proc, tlisp_obj_t *obj)
+{
+    heap_page_t *page = heap_page_of(&proc->heap, obj);
+    size_t idx = HEAP_OBJ_INDEX(page, obj);
+
+    // Free slots are never marked, so new objects start out
+    // young. Those allocated during a cycle are black instead,
+    // so they survive it without having to be traced.
+    if (page->tag < 0) {
+        obj->remembered = 0;
+        obj->in_arena = 0;
+    }
+    if (proc->gc_phase != GC_IDLE) {
+        page->marks[idx / 64] |= HEAP_BIT(idx);
+        proc->nalive++;
+    }
+}
+
+static
+void remember(process_t *proc, tlisp_obj_t *obj)
+{
+    if (proc->nremembered == proc->remembered_cap) {
+        proc->remembered_cap *= 2;
+        proc->remembered = realloc(proc->remembered,
+                                   sizeof(tlisp_obj_t *) * proc->remembered_cap);
+    }
+    set_remembered(proc, obj, 1);
+    proc->remembered[proc->nremembered] = obj;
+    proc->nremembered++;
+}
+
+void gc_write_barrier(process_t *proc, tlisp_obj_t *obj, tlisp_obj_t *val)
+{
+    heap_page_t *page;
+
+    // A NULL val means the builtin moved or unlinked existing
+    // elements rather than storing a new one, so obj has to be
+    // rescanned.
+    //
+    // Otherwise it's a Dijkstra-style insertion barrier: while
+    // marking, never let a black object end up pointing at a
+    // white one.
+    if (proc->gc_phase == GC_MARKING) {
+        if ((!val || OBJ_TAG(obj) == VEC || OBJ_TAG(obj) == DICT) && !is_remembered(proc, obj)) {
+            remember(proc, obj);
+        }
+        gc_mark(val, &proc->mark_stack);
+        return;
+    }
+    if (proc->gc_phase == GC_SWEEPING || is_remembered(proc, obj)) {
+        return;
+    }
+    if (val) {
+        if (IS_FIXNUM(val)) {
+            return;
+        }
+        page = heap_page_of(&proc->heap, val);
+        if (!page || HEAP_IS_MARKED(page, val)) {
+            return;
+        }
+    }
+    page = heap_page_of(&proc->heap, obj);
+    if (page && !HEAP_IS_MARKED(page, obj)) {
+        return;
     }
-    ALIVE = ALIVE == 1 ? 2 : 1;
+    remember(proc, obj);
 }
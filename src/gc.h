@@ -3,6 +3,13 @@
 
 #include "env.h"
 
-void gc(env_t *);
+void gc(process_t *);
+void gc_collect(process_t *);
+size_t gc_min_threshold(process_t *);
+void gc_minor(process_t *);
+void gc_poll(process_t *);
+void gc_init_obj(process_t *, tlisp_obj_t *);
+void gc_write_barrier(process_t *, tlisp_obj_t *obj, tlisp_obj_t *val);
+void gc_tag_bytes(process_t *, size_t *bytes);
 
 #endif
@@ -0,0 +1,348 @@
+
+#include "heap.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const size_t class_sizes[HEAP_NCLASSES] = {
+    32, 48, 64, 96, 128, 192, 256, HEAP_MIN_OBJ, HEAP_MIN_OBJ, HEAP_MIN_OBJ
+};
+static const signed char class_tags[HEAP_NCLASSES] = {
+    -1, -1, -1, -1, -1, -1, -1, CONS, NUM, FLOAT
+};
+
+char *heap_tags_base = NULL;
+size_t heap_tags_span = 0;
+signed char *heap_tags = NULL;
+
+// Indexed by size in 16-byte granules.
+static const unsigned char granule_classes[HEAP_MAX_OBJ / 16 + 1] = {
+    0, 0, 0, 1, 2, 3, 3, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6
+};
+
+static
+void add_young(heap_t *heap, heap_page_t *page)
+{
+    if (heap->nyoung == heap->young_cap) {
+        heap->young_cap *= 2;
+        heap->young = realloc(heap->young, sizeof(heap_page_t *) * heap->young_cap);
+    }
+    heap->young[heap->nyoung] = page;
+    heap->nyoung++;
+}
+
+static
+heap_page_t *new_page(heap_t *heap)
+{
+    heap_page_t *page;
+    size_t slot;
+    char *addr;
+
+    if (heap->nfree_slots) {
+        slot = heap->free_slots[heap->nfree_slots - 1];
+    } else if (heap->nslots < heap->max_pages) {
+        slot = heap->nslots;
+    } else {
+        return NULL;
+    }
+    page = malloc(sizeof(heap_page_t));
+    if (!page) return NULL;
+
+    addr = heap->base + slot * HEAP_PAGE_SIZE;
+    if (mprotect(addr, HEAP_PAGE_SIZE, PROT_READ | PROT_WRITE)) {
+        free(page);
+        return NULL;
+    }
+    if (heap->nfree_slots) {
+        heap->nfree_slots--;
+    } else {
+        heap->nslots++;
+    }
+    heap->slots[slot] = page;
+    page->start = addr;
+    page->cls = -1;
+    page->tag = -1;
+    memset(page->allocs, 0, sizeof(page->allocs));
+    memset(page->marks, 0, sizeof(page->marks));
+    memset(page->remembered, 0, sizeof(page->remembered));
+    page->cursor = 0;
+    page->nalive = 0;
+    page->avail = 0;
+    page->spare = 0;
+    page->next_avail = NULL;
+    page->prev = NULL;
+    page->next = heap->pages;
+    if (heap->pages) {
+        heap->pages->prev = page;
+    }
+    heap->pages = page;
+    heap->npages++;
+    return page;
+}
+
+static
+int reserve(heap_t *heap)
+{
+    size_t i;
+
+    // Nothing is committed yet, so the reservation only costs
+    // address space. The initial pages are committed up front
+    // and kept as spares until they're first allocated into.
+    heap->base = mmap(NULL, heap->max_pages * HEAP_PAGE_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap->base == MAP_FAILED) {
+        heap->base = NULL;
+        return 0;
+    }
+    heap->slots = malloc(sizeof(heap_page_t *) * heap->max_pages);
+    heap->free_slots = malloc(sizeof(size_t) * heap->max_pages);
+    heap_tags = malloc(heap->max_pages);
+    memset(heap_tags, -1, heap->max_pages);
+    heap_tags_base = heap->base;
+    heap_tags_span = heap->max_pages * HEAP_PAGE_SIZE;
+    for (i = 0; i < heap->init_pages && i < heap->max_pages; i++) {
+        heap_page_t *page = new_page(heap);
+
+        if (!page) break;
+        page->spare = 1;
+        page->next_avail = heap->spares;
+        heap->spares = page;
+        heap->nspare++;
+    }
+    return 1;
+}
+
+static
+void set_class(heap_t *heap, heap_page_t *page, int cls)
+{
+    page->cls = cls;
+    page->tag = class_tags[cls];
+    heap_tags[(page->start - heap->base) / HEAP_PAGE_SIZE] = page->tag;
+    page->obj_size = class_sizes[cls];
+    page->nobjs = HEAP_PAGE_SIZE / page->obj_size;
+    page->recip = (((uint64_t)1 << 32) + page->obj_size - 1) / page->obj_size;
+}
+
+static
+heap_page_t *next_page(heap_t *heap, int cls)
+{
+    heap_page_t *page;
+
+    if (!heap->base && !reserve(heap)) {
+        return NULL;
+    }
+
+    // Pages with room in this class come first. Empty pages have
+    // no class until they're allocated into.
+    page = heap->avail[cls];
+    if (page) {
+        heap->avail[cls] = page->next_avail;
+        page->avail = 0;
+        return page;
+    }
+    page = heap->spares;
+    if (page) {
+        heap->spares = page->next_avail;
+        page->spare = 0;
+        heap->nspare--;
+    } else {
+        page = new_page(heap);
+        if (!page) return NULL;
+    }
+    set_class(heap, page, cls);
+    return page;
+}
+
+void heap_init(heap_t *heap)
+{
+    int i;
+
+    heap->init_pages = 0;
+    heap->max_pages = HEAP_DEFAULT_MAX / HEAP_PAGE_SIZE;
+    heap->base = NULL;
+    heap->nslots = 0;
+    heap->slots = NULL;
+    heap->nfree_slots = 0;
+    heap->free_slots = NULL;
+    heap->npages = 0;
+    heap->pages = NULL;
+    for (i = 0; i < HEAP_NCLASSES; i++) {
+        heap->curr[i] = NULL;
+        heap->avail[i] = NULL;
+    }
+    heap->spares = NULL;
+    heap->nspare = 0;
+    heap->nyoung = 0;
+    heap->young_cap = 16;
+    heap->young = malloc(sizeof(heap_page_t *) * heap->young_cap);
+}
+
+static
+tlisp_obj_t *page_alloc(heap_page_t *page)
+{
+    size_t i;
+
+    // Free slots are the clear bits in the allocation bitmap. The
+    // cursor only moves forward between sweeps, so each word is
+    // searched at most once while it's full. Bits past the end of
+    // a page with fewer objects are never set, and the first one
+    // found means the page is full.
+    for (i = page->cursor; i < HEAP_BITMAP_WORDS; i++) {
+        uint64_t free_bits = ~page->allocs[i];
+
+        if (free_bits) {
+            int bit = __builtin_ctzll(free_bits);
+
+            if (i * 64 + bit >= page->nobjs) {
+                break;
+            }
+            page->allocs[i] |= (uint64_t)1 << bit;
+            page->cursor = i;
+            return HEAP_OBJ_AT(page, i * 64 + bit);
+        }
+    }
+    page->cursor = HEAP_BITMAP_WORDS;
+    return NULL;
+}
+
+static
+tlisp_obj_t *class_alloc(heap_t *heap, int cls)
+{
+    heap_page_t *page = heap->curr[cls];
+    tlisp_obj_t *obj;
+
+    while (!page || !(obj = page_alloc(page))) {
+        page = next_page(heap, cls);
+        if (!page) {
+            return NULL;
+        }
+        heap->curr[cls] = page;
+        add_young(heap, page);
+    }
+    return obj;
+}
+
+tlisp_obj_t *heap_alloc(heap_t *heap, size_t size)
+{
+    return class_alloc(heap, granule_classes[(size + 15) / 16]);
+}
+
+tlisp_obj_t *heap_alloc_compact(heap_t *heap, enum obj_tag_t tag)
+{
+    int cls = HEAP_NSIZED;
+
+    while (class_tags[cls] != tag) {
+        cls++;
+    }
+    return class_alloc(heap, cls);
+}
+
+heap_page_t *heap_page_of(heap_t *heap, tlisp_obj_t *obj)
+{
+    // Addresses below the base wrap around and fail the bounds
+    // check too.
+    uintptr_t off = (uintptr_t)obj - (uintptr_t)heap->base;
+
+    if (off >= heap->nslots * HEAP_PAGE_SIZE) {
+        return NULL;
+    }
+    return heap->slots[off / HEAP_PAGE_SIZE];
+}
+
+void heap_free_page(heap_t *heap, heap_page_t *page)
+{
+    size_t slot = (page->start - heap->base) / HEAP_PAGE_SIZE;
+
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        heap->pages = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    if (page->cls >= 0 && heap->curr[page->cls] == page) {
+        heap->curr[page->cls] = NULL;
+    }
+    heap->npages--;
+
+    // Mapping fresh PROT_NONE memory over the page hands it back
+    // to the system but keeps the address range reserved.
+    mmap(page->start, HEAP_PAGE_SIZE, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    heap->slots[slot] = NULL;
+    heap_tags[slot] = -1;
+    heap->free_slots[heap->nfree_slots] = slot;
+    heap->nfree_slots++;
+    free(page);
+}
+
+void heap_clear_marks(heap_t *heap)
+{
+    heap_page_t *page;
+
+    for (page = heap->pages; page; page = page->next) {
+        memset(page->marks, 0, sizeof(page->marks));
+    }
+}
+
+void heap_page_swept(heap_t *heap, heap_page_t *page)
+{
+    page->cursor = 0;
+    page->avail = 0;
+    page->spare = 0;
+    if (page->cls >= 0 && page == heap->curr[page->cls]) {
+        return;
+    }
+
+    // Objects never move, so the only memory handed back is
+    // pages with nothing left alive on them. A few are kept as
+    // spares so a steady-state workload doesn't keep freeing
+    // pages only to allocate them again.
+    if (!page->nalive) {
+        if (heap->nspare >= HEAP_SPARE_PAGES && heap->npages > heap->init_pages) {
+            heap_free_page(heap, page);
+            return;
+        }
+        page->spare = 1;
+        page->next_avail = heap->spares;
+        heap->spares = page;
+        heap->nspare++;
+        return;
+    }
+    if (page->nalive < page->nobjs) {
+        page->avail = 1;
+        page->next_avail = heap->avail[page->cls];
+        heap->avail[page->cls] = page;
+    }
+}
+
+void heap_reset_avail(heap_t *heap)
+{
+    int i;
+
+    // Every page is about to be swept and, if it still has room,
+    // added back.
+    for (i = 0; i < HEAP_NCLASSES; i++) {
+        heap->avail[i] = NULL;
+    }
+    heap->spares = NULL;
+    heap->nspare = 0;
+}
+
+void heap_reset_young(heap_t *heap)
+{
+    int i;
+
+    // Everything allocated so far is now old. New objects only
+    // ever land on the current pages or on pages heap_alloc moves
+    // on to, so those are all the next minor collection has to
+    // sweep.
+    heap->nyoung = 0;
+    for (i = 0; i < HEAP_NCLASSES; i++) {
+        if (heap->curr[i]) {
+            add_young(heap, heap->curr[i]);
+        }
+    }
+}
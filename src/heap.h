@@ -0,0 +1,88 @@
+#ifndef TLISP_HEAP_H_
+#define TLISP_HEAP_H_
+
+#include "core.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEAP_PAGE_SIZE ((size_t)1 << HEAP_PAGE_SHIFT) /* 64 KB */
+#define HEAP_PAGE_OBJS (HEAP_PAGE_SIZE / HEAP_MIN_OBJ)
+#define HEAP_SPARE_PAGES 4 /* Empty pages kept around rather than freed. */
+#define HEAP_DEFAULT_MAX ((size_t)4 << 30) /* Address space reserved for the heap. */
+#define HEAP_BITMAP_WORDS (HEAP_PAGE_OBJS / 64)
+
+// Objects are allocated from size classes, 32 to 256 bytes, and each
+// page holds objects of a single class. Anything bigger keeps its
+// payload out of line.
+//
+// Conses and boxed numbers make up most of the heap and have no
+// header at all. They're 16-byte cells on pages holding a single
+// type, one class per type, and OBJ_TAG reads the type off the page.
+#define HEAP_NSIZED 7
+#define HEAP_NCLASSES (HEAP_NSIZED + 3)
+#define HEAP_MAX_OBJ 256
+#define HEAP_MIN_OBJ 16
+
+// Mark and allocation bits live in the page descriptor rather than
+// in the objects, so a collection only writes to the side tables
+// and pages stay shared between forked processes. An object's index
+// is its offset times the reciprocal of the page's object size.
+#define HEAP_OBJ_INDEX(page, obj) \
+    ((size_t)(((uint64_t)((char *)(obj) - (page)->start) * (page)->recip) >> 32))
+#define HEAP_OBJ_AT(page, idx) ((tlisp_obj_t *)((page)->start + (idx) * (page)->obj_size))
+#define HEAP_BIT(idx) ((uint64_t)1 << ((idx) % 64))
+#define HEAP_IS_MARKED(page, obj) \
+    ((page)->marks[HEAP_OBJ_INDEX(page, obj) / 64] & HEAP_BIT(HEAP_OBJ_INDEX(page, obj)))
+
+typedef struct heap_page_t {
+    char *start;
+    int cls;
+    signed char tag; /* The type of a compact page's cells, or -1. */
+    size_t obj_size;
+    size_t nobjs;
+    uint64_t recip;
+    uint64_t allocs[HEAP_BITMAP_WORDS];
+    uint64_t marks[HEAP_BITMAP_WORDS];
+    uint64_t remembered[HEAP_BITMAP_WORDS]; /* Compact cells only. */
+    size_t cursor;
+    size_t nalive;
+    char avail;
+    char spare;
+    struct heap_page_t *next_avail;
+    struct heap_page_t *prev;
+    struct heap_page_t *next;
+} heap_page_t;
+
+// The heap is one reservation of address space, committed a page at
+// a time as it's needed. Pages live at fixed slots in it, so finding
+// the page an object belongs to is a subtraction and a lookup.
+typedef struct heap_t {
+    size_t init_pages;
+    size_t max_pages;
+    char *base;
+    size_t nslots;
+    heap_page_t **slots;
+    size_t nfree_slots;
+    size_t *free_slots;
+    size_t npages;
+    heap_page_t *pages;
+    heap_page_t *curr[HEAP_NCLASSES];
+    heap_page_t *avail[HEAP_NCLASSES];
+    heap_page_t *spares;
+    size_t nspare;
+    size_t nyoung;
+    size_t young_cap;
+    heap_page_t **young;
+} heap_t;
+
+void heap_init(heap_t *);
+tlisp_obj_t *heap_alloc(heap_t *, size_t);
+tlisp_obj_t *heap_alloc_compact(heap_t *, enum obj_tag_t);
+heap_page_t *heap_page_of(heap_t *, tlisp_obj_t *);
+void heap_free_page(heap_t *, heap_page_t *);
+void heap_clear_marks(heap_t *);
+void heap_page_swept(heap_t *, heap_page_t *);
+void heap_reset_avail(heap_t *);
+void heap_reset_young(heap_t *);
+
+#endif
@@ -0,0 +1,79 @@
+
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_SYMS_CAP 256
+
+static tlisp_obj_t **syms = NULL;
+static size_t syms_len = 0;
+static size_t syms_cap = 0;
+static int next_sym_id = 0;
+
+static
+size_t name_hash(const char *str, size_t len)
+{
+    size_t hash = 5381;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash << 5) + hash + str[i];
+    }
+    return hash;
+}
+
+static
+void syms_insert(tlisp_obj_t *sym)
+{
+    size_t idx = sym->sym_hash & (syms_cap - 1);
+
+    while (syms[idx]) {
+        idx = (idx + 1) & (syms_cap - 1);
+    }
+    syms[idx] = sym;
+    syms_len++;
+}
+
+static
+void syms_grow()
+{
+    tlisp_obj_t **old = syms;
+    size_t old_cap = syms_cap;
+    size_t i;
+
+    syms_cap = syms_cap ? syms_cap * 2 : MIN_SYMS_CAP;
+    syms = calloc(syms_cap, sizeof(tlisp_obj_t *));
+    syms_len = 0;
+    for (i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            syms_insert(old[i]);
+        }
+    }
+    free(old);
+}
+
+tlisp_obj_t *intern(const char *name, size_t len)
+{
+    size_t hash = name_hash(name, len);
+    size_t idx;
+    tlisp_obj_t *sym;
+
+    if (syms_len >= (syms_cap * 3) / 4) {
+        syms_grow();
+    }
+    idx = hash & (syms_cap - 1);
+    while ((sym = syms[idx])) {
+        if (sym->sym_hash == hash && !strncmp(sym->sym, name, len) && !sym->sym[len]) {
+            return sym;
+        }
+        idx = (idx + 1) & (syms_cap - 1);
+    }
+    sym = calloc(1, sizeof(tlisp_obj_t));
+    sym->tag = SYMBOL;
+    sym->sym = strndup(name, len);
+    sym->sym_hash = hash;
+    sym->sym_id = next_sym_id++;
+    syms[idx] = sym;
+    syms_len++;
+    return sym;
+}
@@ -0,0 +1,13 @@
+#ifndef TLISP_INTERN_H_
+#define TLISP_INTERN_H_
+
+#include "core.h"
+#include <stddef.h>
+
+// Every distinct symbol is a single object that lives for the life of
+// the process, so symbols and their names compare by pointer. Each
+// is also numbered, in the order they're made, and its number is its
+// slot in the global env.
+tlisp_obj_t *intern(const char *name, size_t len);
+
+#endif
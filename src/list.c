@@ -1,18 +1,19 @@
 
 #include "list.h"
+#include "gc.h"
 #include <assert.h>
 
 list_t *list_ins(list_t *list, list_t *cons)
 {
-    assert(cons->tag == CONS);
+    assert(OBJ_TAG(cons) == CONS);
     
     cons->cdr = list;
     return cons;   
 }
 
-list_t *list_ins_at(list_t *list, list_t *cons, int idx)
+list_t *list_ins_at(list_t *list, list_t *cons, int idx, process_t *proc)
 {
-    assert(cons->tag == CONS);
+    assert(OBJ_TAG(cons) == CONS);
     
     if (idx == 0) {
         return list_ins(list, cons);
@@ -26,7 +27,9 @@ list_t *list_ins_at(list_t *list, list_t *cons, int idx)
         }
         if (curr) {
             cons->cdr = curr->cdr;
+            gc_write_barrier(proc, cons, cons->cdr);
             curr->cdr = cons;
+            gc_write_barrier(proc, curr, cons);
         }
         return list;
     }    
@@ -44,7 +47,7 @@ tlisp_obj_t *list_get(list_t *list, int idx)
     return curr ? curr->car : NULL;
 }
 
-list_t *list_rem(list_t *list, tlisp_obj_t *obj)
+list_t *list_rem(list_t *list, tlisp_obj_t *obj, process_t *proc)
 {
     if (obj_equals(list->car, obj)) {
         return list->cdr;
@@ -54,6 +57,7 @@ list_t *list_rem(list_t *list, tlisp_obj_t *obj)
         while (curr->cdr) {
             if (obj_equals(curr->cdr->car, obj)) {
                 curr->cdr = curr->cdr->cdr;
+                gc_write_barrier(proc, curr, curr->cdr);
             }
             curr = curr->cdr;
         }
@@ -61,7 +65,7 @@ list_t *list_rem(list_t *list, tlisp_obj_t *obj)
     }
 }
 
-list_t *list_rem_at(list_t *list, int idx)
+list_t *list_rem_at(list_t *list, int idx, process_t *proc)
 {
     if (idx == 0) {
         return list->cdr;
@@ -75,6 +79,7 @@ list_t *list_rem_at(list_t *list, int idx)
         }
         if (curr && curr->cdr) {
             curr->cdr = curr->cdr->cdr;
+            gc_write_barrier(proc, curr, curr->cdr);
         }
         return list;
     }
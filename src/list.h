@@ -2,14 +2,17 @@
 #define TLISP_LIST_H_
 
 #include "core.h"
+#include "process.h"
 
 typedef tlisp_obj_t list_t;
 
 list_t *list_ins(list_t *, list_t *cons);
-list_t *list_ins_at(list_t *, list_t *cons, int);
+// Those that relink cells in place run the write barrier on each
+// cell they change.
+list_t *list_ins_at(list_t *, list_t *cons, int, process_t *);
 tlisp_obj_t *list_get(list_t *, int);
-list_t *list_rem(list_t *, tlisp_obj_t *);
-list_t *list_rem_at(list_t *, int);
+list_t *list_rem(list_t *, tlisp_obj_t *, process_t *);
+list_t *list_rem_at(list_t *, int, process_t *);
 int list_len(tlisp_obj_t *);
 
 #endif
@@ -0,0 +1,175 @@
+
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each block starts with a header holding its size class, or for
+// large blocks its total size. The free list link reuses the
+// header's space.
+typedef union pool_block_t {
+    union pool_block_t *next;
+    size_t size;
+} pool_block_t;
+
+#define CLASS_SIZE(cls) ((size_t)16 << (cls))
+#define LARGE_SIZE(size) ((size) >= POOL_NCLASSES)
+
+static pool_block_t *free_lists[POOL_NCLASSES];
+static char *chunk = NULL;
+static size_t chunk_left = 0;
+
+// Blocks are normally allocated and freed by the one interpreter
+// thread. A parallel sweep frees from several, and takes the lock
+// while it does.
+static int concurrent = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static
+int size_class(size_t size)
+{
+    int cls = 0;
+
+    while (cls < POOL_NCLASSES && CLASS_SIZE(cls) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+static
+pool_block_t *carve(int cls)
+{
+    size_t size = CLASS_SIZE(cls);
+    pool_block_t *block;
+
+    // Whatever is left of the old chunk is too small for this
+    // class; hand it out as smaller blocks rather than waste it.
+    if (chunk_left < size) {
+        while (chunk_left >= CLASS_SIZE(0)) {
+            int small = size_class(chunk_left);
+
+            if (CLASS_SIZE(small) > chunk_left) {
+                small--;
+            }
+            block = (pool_block_t *)chunk;
+            block->next = free_lists[small];
+            free_lists[small] = block;
+            chunk += CLASS_SIZE(small);
+            chunk_left -= CLASS_SIZE(small);
+        }
+        chunk = malloc(POOL_CHUNK_SIZE);
+        if (!chunk) {
+            chunk_left = 0;
+            return NULL;
+        }
+        chunk_left = POOL_CHUNK_SIZE;
+    }
+    block = (pool_block_t *)chunk;
+    chunk += size;
+    chunk_left -= size;
+    return block;
+}
+
+void pool_set_concurrent(int on)
+{
+    concurrent = on;
+}
+
+void *pool_alloc(size_t size)
+{
+    size_t total = size + sizeof(pool_block_t);
+    int cls = size_class(total);
+    pool_block_t *block;
+
+    if (cls == POOL_NCLASSES) {
+        block = malloc(total);
+        if (!block) return NULL;
+        block->size = total;
+        return block + 1;
+    }
+    block = free_lists[cls];
+    if (block) {
+        free_lists[cls] = block->next;
+    } else {
+        block = carve(cls);
+        if (!block) return NULL;
+    }
+    block->size = cls;
+    return block + 1;
+}
+
+void *pool_calloc(size_t size)
+{
+    void *ptr = pool_alloc(size);
+
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void *pool_realloc(void *ptr, size_t size)
+{
+    pool_block_t *block;
+    size_t total = size + sizeof(pool_block_t);
+    size_t old_total;
+    void *res;
+
+    if (!ptr) {
+        return pool_alloc(size);
+    }
+    block = (pool_block_t *)ptr - 1;
+    if (LARGE_SIZE(block->size)) {
+        if (size_class(total) == POOL_NCLASSES) {
+            block = realloc(block, total);
+            if (!block) return NULL;
+            block->size = total;
+            return block + 1;
+        }
+        old_total = block->size;
+    } else {
+        if (size_class(total) == block->size) {
+            return ptr;
+        }
+        old_total = CLASS_SIZE(block->size);
+    }
+    res = pool_alloc(size);
+    if (!res) return NULL;
+    memcpy(res, ptr, (old_total < total ? old_total : total) - sizeof(pool_block_t));
+    pool_free(ptr);
+    return res;
+}
+
+void pool_free(void *ptr)
+{
+    pool_block_t *block;
+    size_t cls;
+
+    if (!ptr) return;
+
+    block = (pool_block_t *)ptr - 1;
+    if (LARGE_SIZE(block->size)) {
+        free(block);
+        return;
+    }
+    cls = block->size;
+    if (concurrent) {
+        pthread_mutex_lock(&lock);
+    }
+    block->next = free_lists[cls];
+    free_lists[cls] = block;
+    if (concurrent) {
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+char *pool_strdup(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *res = pool_alloc(len);
+
+    if (res) {
+        memcpy(res, str, len);
+    }
+    return res;
+}
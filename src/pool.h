@@ -0,0 +1,21 @@
+#ifndef TLISP_POOL_H_
+#define TLISP_POOL_H_
+
+#include <stddef.h>
+
+// Size-class pools for the out-of-line payloads of heap objects:
+// string bytes, vector elems, dict entries and struct fields.
+// Blocks are recycled through per-class free lists, and anything
+// bigger than the largest class goes straight to malloc.
+
+#define POOL_CHUNK_SIZE 65536 /* 64 KB */
+#define POOL_NCLASSES 8 /* 16 bytes up to 2 KB, doubling. */
+
+void pool_set_concurrent(int);
+void *pool_alloc(size_t);
+void *pool_calloc(size_t);
+void *pool_realloc(void *, size_t);
+void pool_free(void *);
+char *pool_strdup(const char *);
+
+#endif
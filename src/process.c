@@ -1,38 +1,84 @@
 
 #include "process.h"
 #include "dict.h"
+#include "gc.h"
+#include "pool.h"
+#include "strbuf.h"
 #include "vector.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// A non-negative tag asks for a compact object of that type, and
+// size is ignored.
 static
-tlisp_obj_t *new_obj(process_t *proc)
+tlisp_obj_t *alloc_obj(process_t *proc, size_t size, int tag)
 {
     tlisp_obj_t *obj;
-    
-    if (proc->heap_len == proc->heap_cap) {
-        tlisp_obj_t *heap;
-        
-        proc->heap_cap *= 2;
-        heap = malloc(sizeof(tlisp_obj_t) * proc->heap_cap);
-        memcpy(heap, proc->heap, sizeof(tlisp_obj_t) * proc->heap_len);
-        free(proc->heap);
-        proc->heap = heap;
+
+    gc_poll(proc);
+    obj = tag < 0 ? heap_alloc(&proc->heap, size) : heap_alloc_compact(&proc->heap, tag);
+    if (!obj) {
+        // The heap is at its limit. A full collection may still
+        // free enough to carry on.
+        gc_collect(proc);
+        obj = tag < 0 ? heap_alloc(&proc->heap, size) : heap_alloc_compact(&proc->heap, tag);
     }
-    obj = proc->heap + proc->heap_len;
-    obj->mark = 0;
+    if (!obj) {
+        proc_fatal(proc, "ERROR: Out of memory.\n");
+    }
+    gc_init_obj(proc, obj);
     proc->heap_len++;
+    proc->nallocs++;
+    proc->heap_cap = proc->heap.npages * HEAP_PAGE_OBJS;
     return obj;
 }
 
+static
+tlisp_obj_t *new_obj(process_t *proc, size_t size)
+{
+    return alloc_obj(proc, size, -1);
+}
+
 void proc_init(process_t *proc)
 {
     proc->nalive = 0;
     proc->heap_len = 0;
-    proc->heap_cap = (MIN_HEAP_SIZE + sizeof(tlisp_obj_t) - 1) / sizeof(tlisp_obj_t);
-    proc->heap = malloc(sizeof(tlisp_obj_t) * proc->heap_cap);
+    proc->heap_cap = 0;
+    heap_init(&proc->heap);
+    proc->nallocs = 0;
+    proc->gc_threshold = MIN_GC_THRESHOLD;
+    proc->gc_growth = GC_GROWTH;
+    proc->gc_phase = GC_IDLE;
+    proc->gc_pause_us = 0;
+    proc->sweep_cursor = NULL;
+    proc->gc_threads = 1;
+    proc->mark_stack.proc = proc;
+    proc->mark_stack.nalive = &proc->nalive;
+    proc->mark_stack.len = 0;
+    proc->mark_stack.cap = 256;
+    proc->mark_stack.overflow = 0;
+    proc->mark_stack.entries = malloc(sizeof(mark_entry_t) * proc->mark_stack.cap);
+    memset(&proc->gc_stats, 0, sizeof(gc_stats_t));
+    proc->gc_trace = NULL;
+    proc->nroots = 0;
+    proc->roots_cap = 64;
+    proc->roots = malloc(sizeof(tlisp_obj_t **) * proc->roots_cap);
+    proc->nenvs = 0;
+    proc->envs_cap = 64;
+    proc->envs = malloc(sizeof(struct env_t *) * proc->envs_cap);
+    proc->genv = NULL;
+    proc->vm_stack = malloc(sizeof(tlisp_obj_t *) * VM_STACK_SIZE);
+    proc->vm_sp = 0;
+    proc->nremembered = 0;
+    proc->remembered_cap = 64;
+    proc->remembered = malloc(sizeof(tlisp_obj_t *) * proc->remembered_cap);
+    proc->arenas = NULL;
+    proc->arena_bytes = 0;
+    proc->arena_threshold = MIN_ARENA_THRESHOLD;
+    proc->line_info = NULL;
     proc->curr_expr = NULL;
+    proc->nfiles = 0;
 }
 
 void proc_fatal(process_t *proc, const char *msg)
@@ -45,52 +91,163 @@ void proc_fatal(process_t *proc, const char *msg)
     exit(1);
 }
 
+void proc_push_root(process_t *proc, tlisp_obj_t **root)
+{
+    if (proc->nroots == proc->roots_cap) {
+        proc->roots_cap *= 2;
+        proc->roots = realloc(proc->roots, sizeof(tlisp_obj_t **) * proc->roots_cap);
+    }
+    proc->roots[proc->nroots] = root;
+    proc->nroots++;
+}
+
+void proc_pop_roots(process_t *proc, int n)
+{
+    proc->nroots -= n;
+}
+
+void proc_push_env(process_t *proc, struct env_t *env)
+{
+    if (proc->nenvs == proc->envs_cap) {
+        proc->envs_cap *= 2;
+        proc->envs = realloc(proc->envs, sizeof(struct env_t *) * proc->envs_cap);
+    }
+    proc->envs[proc->nenvs] = env;
+    proc->nenvs++;
+}
+
+void proc_pop_env(process_t *proc, struct env_t *env)
+{
+    int i = proc->nenvs - 1;
+
+    // Envs are almost always destroyed in the reverse order
+    // they were created in, so search from the top.
+    while (i >= 0 && proc->envs[i] != env) {
+        i--;
+    }
+    if (i < 0) return;
+
+    for (; i < proc->nenvs - 1; i++) {
+        proc->envs[i] = proc->envs[i + 1];
+    }
+    proc->nenvs--;
+}
+
+void proc_release_source(process_t *proc, source_t *source)
+{
+    arena_t *arena = source->arena;
+
+    // Code that's done running may still be referenced, by a
+    // lambda it defined say, so the arena is handed to the
+    // collector rather than freed. It's kept through any cycle
+    // already under way, since that may not have traced it.
+    if (proc->line_info == &source->line_info) {
+        proc->line_info = NULL;
+        proc->curr_expr = NULL;
+    }
+    free(source->expressions);
+    source->expressions = NULL;
+    source->nexpressions = 0;
+    arena->live = 1;
+    arena->next = proc->arenas;
+    proc->arenas = arena;
+
+    // Reader objects don't count towards the heap, so released
+    // sources need their own trigger for a full collection.
+    proc->arena_bytes += arena->size;
+    if (proc->arena_bytes >= proc->arena_threshold && proc->gc_phase == GC_IDLE) {
+        gc_collect(proc);
+    }
+}
+
 #define DEF_CONSTRUCTOR(abbrev, tag_)                   \
     tlisp_obj_t *proc_new_##abbrev(process_t *proc)     \
     {                                                   \
-        tlisp_obj_t *obj = new_obj(proc);               \
+        tlisp_obj_t *obj = new_obj(proc, sizeof(tlisp_obj_t));               \
         obj->tag = tag_;                                \
         return obj;                                     \
     }                                                   \
     
-DEF_CONSTRUCTOR(str, STRING)
-DEF_CONSTRUCTOR(sym, SYMBOL)
-DEF_CONSTRUCTOR(num, NUM)
+// Compact objects have no header to fill in.
+#define DEF_COMPACT_CONSTRUCTOR(abbrev, tag_)           \
+    tlisp_obj_t *proc_new_##abbrev(process_t *proc)     \
+    {                                                   \
+        return alloc_obj(proc, HEAP_MIN_OBJ, tag_);     \
+    }                                                   \
+
+DEF_COMPACT_CONSTRUCTOR(num, NUM)
+DEF_COMPACT_CONSTRUCTOR(float, FLOAT)
 DEF_CONSTRUCTOR(lambda, LAMBDA)
 DEF_CONSTRUCTOR(macro, MACRO)
 DEF_CONSTRUCTOR(structdef, STRUCTDEF)
-DEF_CONSTRUCTOR(struct, STRUCT)
+
+// The string takes ownership of str, a pool allocation.
+tlisp_obj_t *proc_new_str(process_t *proc, char *str, size_t len)
+{
+    tlisp_obj_t *obj = new_obj(proc, sizeof(tlisp_obj_t));
+    obj->tag = STRING;
+    obj->str = str;
+    obj->str_len = len;
+    obj->str_hash = 0;
+    return obj;
+}
+
+tlisp_obj_t *proc_new_strbuilder(process_t *proc)
+{
+    tlisp_obj_t *obj = new_obj(proc, sizeof(tlisp_obj_t));
+    obj->tag = STRBUILDER;
+    strbuf_init(&obj->strbuf);
+    return obj;
+}
 
 tlisp_obj_t *proc_new_cons(process_t *proc)
 {
-    tlisp_obj_t *obj = new_obj(proc);
-    obj->tag = CONS;
-    obj->cdr = NULL; 
+    tlisp_obj_t *obj = alloc_obj(proc, HEAP_MIN_OBJ, CONS);
+    obj->car = NULL;
+    obj->cdr = NULL;
     return obj;
 }
 
 tlisp_obj_t *proc_new_dict(process_t *proc)
 {
-    tlisp_obj_t *obj = new_obj(proc);
+    tlisp_obj_t *obj = new_obj(proc, sizeof(tlisp_obj_t));
     obj->tag = DICT;
     dict_init(&obj->dict);
     return obj;
 }
 
+tlisp_obj_t *proc_new_struct(process_t *proc, int nfields)
+{
+    size_t size = sizeof(tlisp_obj_t) + sizeof(tlisp_obj_t *) * nfields;
+    tlisp_obj_t *obj;
+
+    if (size <= HEAP_MAX_OBJ) {
+        obj = new_obj(proc, size);
+        obj->structobj.fields = OBJ_PAYLOAD(obj);
+        obj->structobj.is_inline = 1;
+    } else {
+        obj = new_obj(proc, sizeof(tlisp_obj_t));
+        obj->structobj.fields = pool_alloc(sizeof(tlisp_obj_t *) * nfields);
+        obj->structobj.is_inline = 0;
+    }
+    obj->tag = STRUCT;
+    return obj;
+}
+
 tlisp_obj_t *proc_new_vec(process_t *proc)
 {
-    tlisp_obj_t *obj = new_obj(proc);
+    tlisp_obj_t *obj = new_obj(proc, sizeof(tlisp_obj_t) + sizeof(tlisp_obj_t *) * VEC_INLINE_CAP);
     obj->tag = VEC;
-    vec_init(&obj->vec);
+    vec_init(&obj->vec, OBJ_PAYLOAD(obj), VEC_INLINE_CAP);
     return obj;
 }
 
 static
 int proc_fcheck(process_t *proc, tlisp_obj_t *fobj)
 {
-    return fobj->tag == NUM &&
-        fobj->num >= 0 &&
-        fobj->num < proc->nfiles;
+    return IS_FIXNUM(fobj) &&
+        FIXNUM_VAL(fobj) >= 0 &&
+        FIXNUM_VAL(fobj) < proc->nfiles;
 }
 
 tlisp_obj_t *proc_open(process_t *proc, const char *fname, const char *mode)
@@ -105,8 +262,7 @@ tlisp_obj_t *proc_open(process_t *proc, const char *fname, const char *mode)
     if (!f) {
         return NULL;
     }
-    fobj = proc_new_num(proc);
-    fobj->num = proc->nfiles;
+    fobj = FIXNUM(proc->nfiles);
     proc->ftable[proc->nfiles] = f;
     proc->nfiles++;
     return fobj;
@@ -117,7 +273,7 @@ FILE *proc_getf(process_t *proc, tlisp_obj_t *fobj)
     if (!proc_fcheck(proc, fobj)) {
         return NULL;
     }
-    return proc->ftable[fobj->num];
+    return proc->ftable[FIXNUM_VAL(fobj)];
 }
 
 int proc_close(process_t *proc, tlisp_obj_t *fobj)
@@ -129,9 +285,9 @@ int proc_close(process_t *proc, tlisp_obj_t *fobj)
     if (!proc_fcheck(proc, fobj)) {
         return 0;
     }
-    f = proc->ftable[fobj->num];
+    f = proc->ftable[FIXNUM_VAL(fobj)];
     res = fclose(f) != EOF;
-    for (i = fobj->num + 1; i < proc->nfiles; i++) {
+    for (i = FIXNUM_VAL(fobj) + 1; i < proc->nfiles; i++) {
         proc->ftable[i - 1] = proc->ftable[i];
     }
     proc->nfiles--;
@@ -2,16 +2,89 @@
 #define TLISP_PROCESS_H_
 
 #include "core.h"
+#include "heap.h"
+#include <stdint.h>
 #include <stdio.h>
 
-#define MIN_HEAP_SIZE 256000000 /* 256 MB */
 #define MAX_FILES 128
+#define NURSERY_SIZE 32768 /* Allocations between minor collections. */
+#define MIN_GC_THRESHOLD 65536 /* Old objects before a full collection. */
+#define GC_GROWTH 2.0 /* Live set multiple before the next full collection. */
+#define MIN_ARENA_THRESHOLD (1 << 20) /* Bytes of released source before a full collection. */
+#define GC_SLICE_SIZE 4096 /* Allocations between incremental GC slices. */
+#define MARK_STACK_MAX (1 << 22) /* Entries before the mark stack overflows. */
+#define VM_STACK_SIZE 65536 /* Slots in the bytecode VM's value stack. */
+
+struct env_t; // Forward declaration.
+
+enum gc_phase_t {
+    GC_IDLE,
+    GC_MARKING,
+    GC_SWEEPING
+};
+
+// An object waiting to be scanned by the collector. Large vectors,
+// dicts and lists are scanned a chunk at a time, and idx says where
+// the next chunk starts.
+typedef struct mark_entry_t {
+    tlisp_obj_t *obj;
+    int idx;
+} mark_entry_t;
+
+// Marking state for one thread. The process has its own, and each
+// parallel GC worker gets one more.
+typedef struct mark_stack_t {
+    struct process_t *proc;
+    size_t *nalive;
+    int len;
+    int cap;
+    int overflow;
+    mark_entry_t *entries;
+} mark_stack_t;
+
+// Collector counters, reported by gc-stats. The cycle_ fields
+// describe the collection in progress and feed the trace log.
+typedef struct gc_stats_t {
+    size_t nminor;
+    size_t nfull;
+    uint64_t pause_total_us;
+    uint64_t pause_max_us;
+    const char *cycle_kind;
+    uint64_t cycle_us;
+    size_t cycle_heap_len;
+    size_t cycle_freed[NUM_TAGS]; /* Bytes, by tag. */
+} gc_stats_t;
 
 typedef struct process_t {
     size_t nalive;
     size_t heap_len;
     size_t heap_cap;
-    tlisp_obj_t *heap;
+    heap_t heap;
+    size_t nallocs;
+    size_t gc_threshold;
+    double gc_growth;
+    enum gc_phase_t gc_phase;
+    long gc_pause_us;
+    heap_page_t *sweep_cursor;
+    int gc_threads;
+    mark_stack_t mark_stack;
+    gc_stats_t gc_stats;
+    FILE *gc_trace;
+    int nroots;
+    int roots_cap;
+    tlisp_obj_t ***roots;
+    int nenvs;
+    int envs_cap;
+    struct env_t **envs;
+    struct env_t *genv;
+    tlisp_obj_t **vm_stack;
+    int vm_sp;
+    int nremembered;
+    int remembered_cap;
+    tlisp_obj_t **remembered;
+    arena_t *arenas;
+    size_t arena_bytes;
+    size_t arena_threshold;
     line_info_t *line_info;
     tlisp_obj_t *curr_expr;
     int nfiles;
@@ -20,11 +93,17 @@ typedef struct process_t {
 
 void proc_init(process_t *);
 void proc_fatal(process_t *, const char *);
+void proc_push_root(process_t *, tlisp_obj_t **);
+void proc_pop_roots(process_t *, int);
+void proc_push_env(process_t *, struct env_t *);
+void proc_pop_env(process_t *, struct env_t *);
+void proc_release_source(process_t *, source_t *);
 tlisp_obj_t *proc_new_num(process_t *);
-tlisp_obj_t *proc_new_str(process_t *);
-tlisp_obj_t *proc_new_sym(process_t *);
+tlisp_obj_t *proc_new_float(process_t *);
+tlisp_obj_t *proc_new_str(process_t *, char *str, size_t len);
+tlisp_obj_t *proc_new_strbuilder(process_t *);
 tlisp_obj_t *proc_new_structdef(process_t *);
-tlisp_obj_t *proc_new_struct(process_t *);
+tlisp_obj_t *proc_new_struct(process_t *, int nfields);
 tlisp_obj_t *proc_new_cons(process_t *);
 tlisp_obj_t *proc_new_lambda(process_t *);
 tlisp_obj_t *proc_new_macro(process_t *);
@@ -1,6 +1,8 @@
 
+#include "intern.h"
 #include "read.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,9 +14,9 @@ int whitespace(char c)
 }
 
 static
-int numstart(char c)
+int numstart(const char *s)
 {
-    return isdigit(c) || c == '-';
+    return isdigit(s[0]) || (s[0] == '-' && isdigit(s[1]));
 }
 
 static
@@ -41,17 +43,19 @@ typedef struct read_state {
     char curr_line[MAX_LINE];
     char *cursor;
     int in_comment;
+    arena_t *arena;
 } read_state;
 
 static void reader_adv(read_state *);
 
 static
-void reader_init(read_state *reader, char *source)
+void reader_init(read_state *reader, char *source, arena_t *arena)
 {
     reader->line = 1;
     reader->col = 1;
     reader->cursor = source;
     reader->in_comment = 0;
+    reader->arena = arena;
     copy_line(source, reader->curr_line, MAX_LINE);
 }
 
@@ -132,21 +136,52 @@ void reader_adv_n(read_state *reader, int n)
 static
 tlisp_obj_t *read_num(read_state *reader)
 {
-    tlisp_obj_t *obj = new_num();
-    int neg = 0;
-    int num = 0;
-    char c;
+    tlisp_obj_t *obj;
+    char *end = reader->cursor;
+    int is_float = 0;
+    long long num;
+    double fnum;
+
+    if (*end == '-') {
+        end++;
+    }
+    while (isdigit(*end)) {
+        end++;
+    }
+    if (*end == '.') {
+        is_float = 1;
+        end++;
+        while (isdigit(*end)) {
+            end++;
+        }
+    }
+    if ((*end == 'e' || *end == 'E') &&
+        (isdigit(end[1]) || ((end[1] == '-' || end[1] == '+') && isdigit(end[2])))) {
+        is_float = 1;
+        end += 2;
+        while (isdigit(*end)) {
+            end++;
+        }
+    }
+    if (!is_float) {
+        errno = 0;
+        num = strtoll(reader->cursor, NULL, 10);
+        is_float = errno == ERANGE;
+    }
+    if (is_float) {
+        fnum = strtod(reader->cursor, NULL);
+    }
+    reader_adv_n(reader, end - reader->cursor);
 
-    if (*reader->cursor == '-') {
-        neg = 1;
-        reader_adv(reader);
+    if (is_float) {
+        obj = new_float(reader->arena);
+        obj->fnum = fnum;
+        return obj;
     }
-    while ((c = *reader->cursor) && isdigit(c)) {
-        num *= 10;
-        num += c - '0';
-        reader_adv(reader);
+    if (num >= FIXNUM_MIN && num <= FIXNUM_MAX) {
+        return FIXNUM(num);
     }
-    num = neg ? -num : num;
+    obj = new_num(reader->arena);
     obj->num = num;
     return obj;
 }
@@ -154,7 +189,7 @@ tlisp_obj_t *read_num(read_state *reader)
 static
 tlisp_obj_t *read_str(read_state *reader)
 {
-    tlisp_obj_t *obj = new_str();
+    tlisp_obj_t *obj = new_str(reader->arena);
     char *lead;
     size_t len = 0;
 
@@ -164,7 +199,8 @@ tlisp_obj_t *read_str(read_state *reader)
         len++;
         lead++;
     }
-    obj->str = strndup(reader->cursor, len);
+    obj->str = arena_strndup(reader->arena, reader->cursor, len);
+    obj->str_len = len;
     reader_adv_n(reader, len + 1);
     return obj;
 }
@@ -172,7 +208,7 @@ tlisp_obj_t *read_str(read_state *reader)
 static
 tlisp_obj_t *read_sym(read_state *reader)
 {
-    tlisp_obj_t *obj = new_sym();
+    tlisp_obj_t *obj;
     char *lead = reader->cursor;
     size_t len = 0;
 
@@ -180,7 +216,7 @@ tlisp_obj_t *read_sym(read_state *reader)
         len++;
         lead++;
     }
-    obj->sym = strndup(reader->cursor, len);
+    obj = intern(reader->cursor, len);
     reader_adv_n(reader, len);
     return obj;
 }
@@ -202,7 +238,7 @@ tlisp_obj_t *read_delimited_form(read_state *reader, char delim)
         if (whitespace(c)) {
             reader_adv(reader);
         } else {
-            tlisp_obj_t *next = new_cons();
+            tlisp_obj_t *next = new_cons(reader->arena);
             next->car = read_literal(reader);
             if (head) {
                 curr->cdr = next;
@@ -229,7 +265,7 @@ tlisp_obj_t *read_list_literal(read_state *reader)
 static
 tlisp_obj_t *read_dict_literal(read_state *reader)
 {
-    tlisp_obj_t *obj = new_cons();
+    tlisp_obj_t *obj = new_cons(reader->arena);
 
     obj->car = tlisp_hashtag;
     reader_adv(reader);
@@ -243,7 +279,7 @@ tlisp_obj_t *read_dict_literal(read_state *reader)
 static
 tlisp_obj_t *read_vec_literal(read_state *reader)
 {
-    tlisp_obj_t *obj = new_cons();
+    tlisp_obj_t *obj = new_cons(reader->arena);
     
     obj->car = tlisp_bracket;
     obj->cdr = read_delimited_form(reader, ']');
@@ -253,7 +289,7 @@ tlisp_obj_t *read_vec_literal(read_state *reader)
 static
 tlisp_obj_t *read_quoted_literal(read_state *reader)
 {
-    tlisp_obj_t *obj = new_cons();
+    tlisp_obj_t *obj = new_cons(reader->arena);
 
     obj->car = tlisp_quote;
     reader_adv(reader);
@@ -265,7 +301,7 @@ tlisp_obj_t *read_quoted_literal(read_state *reader)
 static
 tlisp_obj_t *read_bquoted_literal(read_state *reader)
 {
-    tlisp_obj_t *obj = new_cons();
+    tlisp_obj_t *obj = new_cons(reader->arena);
 
     obj->car = tlisp_backquote;
     reader_adv(reader);
@@ -283,7 +319,7 @@ tlisp_obj_t *read_literal(read_state *reader)
 
     if (c == '"') {
         return read_str(reader);
-    } else if (numstart(c)) {
+    } else if (numstart(reader->cursor)) {
         return read_num(reader);
     } else if (c == '(') {
         return read_list_literal(reader);
@@ -307,7 +343,7 @@ source_t read(char *text)
     char c;
     
     source_init(&source, text);
-    reader_init(&reader, text);
+    reader_init(&reader, text, source.arena);
     
     while ((c = *reader.cursor)) {
         if (whitespace(c)) {
@@ -0,0 +1,52 @@
+
+#include "pool.h"
+#include "strbuf.h"
+#include <string.h>
+
+#define MIN_CAP 32
+
+void strbuf_init(tlisp_strbuf_t *sb)
+{
+    sb->buf = NULL;
+    sb->len = 0;
+    sb->cap = 0;
+}
+
+void strbuf_destroy(tlisp_strbuf_t *sb)
+{
+    pool_free(sb->buf);
+}
+
+void strbuf_append(tlisp_strbuf_t *sb, const char *s, size_t len)
+{
+    if (!len) {
+        return;
+    }
+    if (sb->len + len + 1 > sb->cap) {
+        size_t cap = sb->cap ? sb->cap : MIN_CAP;
+        // s may point into the buffer itself.
+        int is_self = sb->buf && s >= sb->buf && s < sb->buf + sb->cap;
+        size_t off = is_self ? s - sb->buf : 0;
+
+        while (sb->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        sb->buf = pool_realloc(sb->buf, cap);
+        sb->cap = cap;
+        if (is_self) {
+            s = sb->buf + off;
+        }
+    }
+    memcpy(sb->buf + sb->len, s, len);
+    sb->len += len;
+    sb->buf[sb->len] = 0;
+}
+
+// Hands the buffer to the caller and leaves the builder empty.
+char *strbuf_take(tlisp_strbuf_t *sb)
+{
+    char *buf = sb->buf ? sb->buf : pool_strdup("");
+
+    strbuf_init(sb);
+    return buf;
+}
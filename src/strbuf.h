@@ -0,0 +1,19 @@
+#ifndef TLISP_STRBUF_H_
+#define TLISP_STRBUF_H_
+
+#include <stddef.h>
+
+// A growable, NUL-terminated byte buffer. Capacity doubles when it
+// runs out, so a run of appends costs time linear in its output.
+typedef struct tlisp_strbuf_t {
+    char *buf;
+    size_t len;
+    size_t cap;
+} tlisp_strbuf_t;
+
+void strbuf_init(tlisp_strbuf_t *);
+void strbuf_destroy(tlisp_strbuf_t *);
+void strbuf_append(tlisp_strbuf_t *, const char *, size_t);
+char *strbuf_take(tlisp_strbuf_t *);
+
+#endif
@@ -1,51 +1,95 @@
 
+#include "pool.h"
 #include "struct.h"
+#include <stdint.h>
 #include <stdlib.h>
-#include <strings.h>
+#include <string.h>
 
-void structdef_destroy(tlisp_structdef_t *sdef)
+static
+int index_cap(int nfields)
 {
-    int i;
+    int cap = 1;
 
-    free(sdef->name);
-    for (i = 0; i < sdef->nfields; i++) {
-        free(sdef->field_names[i]);
+    while (cap < 2 * nfields) {
+        cap *= 2;
     }
-    free(sdef->field_names);
+    return cap;
 }
 
-void struct_destroy(tlisp_struct_t *s)
+static
+size_t name_slot(const char *name, int cap)
 {
-    free(s->fields);
+    return ((((uintptr_t)name >> 3) * 0x9e3779b97f4a7c15ull) >> 32) & (cap - 1);
 }
 
-static
-tlisp_obj_t **struct_field_offset(tlisp_struct_t *s, const char *name)
+void structdef_init(tlisp_structdef_t *sdef, char *name, int nfields)
 {
-    int nfields = s->sdef->nfields;
-    char **field_names = s->sdef->field_names;
+    size_t size = sizeof(char *) * nfields;
+
+    if (nfields >= STRUCT_INDEX_MIN) {
+        size += sizeof(int) * index_cap(nfields);
+    }
+    sdef->name = name;
+    sdef->nfields = nfields;
+    sdef->field_names = malloc(size);
+}
+
+// Builds the name index once field_names is filled in. Slots hold
+// field indices, with -1 for empty.
+void structdef_index(tlisp_structdef_t *sdef)
+{
+    int cap;
+    int *index;
     int i;
 
-    for (i = 0; i < nfields; i++) {
-        if (!strcmp(name, field_names[i])) {
-            return s->fields + i;
+    if (sdef->nfields < STRUCT_INDEX_MIN) return;
+
+    cap = index_cap(sdef->nfields);
+    index = (int *)(sdef->field_names + sdef->nfields);
+    memset(index, 0xff, sizeof(int) * cap);
+    for (i = 0; i < sdef->nfields; i++) {
+        size_t slot = name_slot(sdef->field_names[i], cap);
+        while (index[slot] >= 0) {
+            slot = (slot + 1) & (cap - 1);
         }
+        index[slot] = i;
     }
-    return NULL;
 }
 
-tlisp_obj_t *struct_get_field(tlisp_struct_t *s, const char *name)
+void structdef_destroy(tlisp_structdef_t *sdef)
 {
-    tlisp_obj_t **fieldptr = struct_field_offset(s, name);
-    return fieldptr ? *fieldptr : NULL;
+    free(sdef->field_names);
 }
 
-int struct_setq(tlisp_struct_t *s, const char *name, tlisp_obj_t *to)
+int structdef_field_index(tlisp_structdef_t *sdef, const char *name)
 {
-    tlisp_obj_t **fieldptr = struct_field_offset(s, name);
-    
-    if (!fieldptr) return 0;
+    char **field_names = sdef->field_names;
+    int i;
+
+    if (sdef->nfields >= STRUCT_INDEX_MIN) {
+        int cap = index_cap(sdef->nfields);
+        int *index = (int *)(field_names + sdef->nfields);
+        size_t slot = name_slot(name, cap);
+
+        while ((i = index[slot]) >= 0) {
+            if (field_names[i] == name) {
+                return i;
+            }
+            slot = (slot + 1) & (cap - 1);
+        }
+        return -1;
+    }
+    for (i = 0; i < sdef->nfields; i++) {
+        if (name == field_names[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    *fieldptr = to;
-    return 1;
+void struct_destroy(tlisp_struct_t *s)
+{
+    if (!s->is_inline) {
+        pool_free(s->fields);
+    }
 }
@@ -3,21 +3,28 @@
 
 typedef struct tlisp_obj_t tlisp_obj_t;
 
+// Names are interned symbol names and compare by pointer. Structdefs
+// with at least STRUCT_INDEX_MIN fields also keep a hash index of
+// their field names, stored after field_names in the same block.
+#define STRUCT_INDEX_MIN 8
+
 typedef struct tlisp_structdef_t {
     char *name;
     int nfields;
     char **field_names;
 } tlisp_structdef_t;
 
+void structdef_init(tlisp_structdef_t *, char *name, int nfields);
+void structdef_index(tlisp_structdef_t *);
 void structdef_destroy(tlisp_structdef_t *);
+int structdef_field_index(tlisp_structdef_t *, const char *);
 
 typedef struct tlisp_struct_t {
     tlisp_structdef_t *sdef;
     tlisp_obj_t **fields;
+    char is_inline;     /* fields is the object's own payload. */
 } tlisp_struct_t;
 
 void struct_destroy(tlisp_struct_t *);
-tlisp_obj_t *struct_get_field(tlisp_struct_t *, const char *);
-int struct_setq(tlisp_struct_t *, const char *, tlisp_obj_t *);
 
 #endif
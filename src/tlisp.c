@@ -2,18 +2,21 @@
 #include "builtins.h"
 #include "core.h"
 #include "env.h"
+#include "gc.h"
+#include "intern.h"
 #include "process.h"
 #include "read.h"
+#include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define REGISTER_NFUNC(sym, func)                      \
     do {                                               \
-        tlisp_obj_t *f = malloc(sizeof(tlisp_obj_t));  \
+        tlisp_obj_t *f = calloc(1, sizeof(tlisp_obj_t));  \
         f->fn = func;                                  \
         f->tag = NFUNC;                                \
-        env_add(genv, sym, f);                         \
+        env_add(genv, intern(sym, strlen(sym)), f);    \
     } while (0);                                       \
 
 static
@@ -21,41 +24,25 @@ void genv_init(env_t *genv, process_t *proc)
 {
     env_init(genv, NULL, proc);
     {
-        tlisp_nil = malloc(sizeof(tlisp_obj_t));
+        tlisp_nil = calloc(1, sizeof(tlisp_obj_t));
         tlisp_nil->tag = NIL;
-        env_add(genv, "nil", tlisp_nil);
+        env_add(genv, intern("nil", 3), tlisp_nil);
     }
+    tlisp_quote = intern("'", 1);
+    tlisp_backquote = intern("`", 1);
+    tlisp_hashtag = intern("#", 1);
+    tlisp_bracket = intern("[", 1);
     {
-        tlisp_quote = malloc(sizeof(tlisp_obj_t));
-        tlisp_quote->tag = SYMBOL;
-        tlisp_quote->sym = "'";
-    }
-    {
-        tlisp_backquote = malloc(sizeof(tlisp_obj_t));
-        tlisp_backquote->tag = SYMBOL;
-        tlisp_backquote->sym = "`";
-    }
-    {
-        tlisp_hashtag = malloc(sizeof(tlisp_obj_t));
-        tlisp_hashtag->tag = SYMBOL;
-        tlisp_hashtag->sym = "#";
-    }
-    {
-        tlisp_bracket = malloc(sizeof(tlisp_obj_t));
-        tlisp_bracket->tag = SYMBOL;
-        tlisp_bracket->sym = "[";
-    }
-    {
-        tlisp_true = malloc(sizeof(tlisp_obj_t));
+        tlisp_true = calloc(1, sizeof(tlisp_obj_t));
         tlisp_true->tag = BOOL;
         tlisp_true->num = 1;
-        env_add(genv, "true", tlisp_true);
+        env_add(genv, intern("true", 4), tlisp_true);
     }
     {
-        tlisp_false = malloc(sizeof(tlisp_obj_t));
+        tlisp_false = calloc(1, sizeof(tlisp_obj_t));
         tlisp_false->tag = BOOL;
         tlisp_false->num = 0;
-        env_add(genv, "false", tlisp_false); 
+        env_add(genv, intern("false", 5), tlisp_false); 
     }
     REGISTER_NFUNC("eval", tlisp_eval);
     REGISTER_NFUNC("apply", tlisp_apply);
@@ -112,6 +99,8 @@ void genv_init(env_t *genv, process_t *proc)
     REGISTER_NFUNC("not", tlisp_not);
     REGISTER_NFUNC("print", tlisp_print);
     REGISTER_NFUNC("str", tlisp_str);
+    REGISTER_NFUNC("string-builder", tlisp_string_builder);
+    REGISTER_NFUNC("gc-stats", tlisp_gc_stats);
 }
 
 static
@@ -128,17 +117,30 @@ char *read_file(const char *fname)
         exit(1);
     }
     while ((c = fgetc(fin)) != EOF) {
-        if (len == cap) {
+        if (len == cap - 1) {
             cap *= 2;
             buff = realloc(buff, sizeof(char) * cap); 
         }
         buff[len] = c;
         len++;
     }
+    buff[len] = 0;
     fclose(fin);
     return buff;
 }
 
+static int use_vm = 0;
+
+static
+tlisp_obj_t *run(tlisp_obj_t *expr, env_t *genv, source_t *source)
+{
+    if (use_vm) {
+        return vm_eval(expr, genv, source->arena);
+    }
+    resolve_locals(expr, genv);
+    return eval(expr, genv);
+}
+
 static
 int tlisp_repl(env_t *genv)
 {
@@ -155,12 +157,16 @@ int tlisp_repl(env_t *genv)
         }
         in = read(line);
         if (in.nexpressions == 0) {
+            proc_release_source(genv->proc, &in);
             continue;
         }
         for (i = 0; i < in.nexpressions; i++) {
-            res = eval(in.expressions[i], genv);
+            proc_push_root(genv->proc, &in.expressions[i]);
+            res = run(in.expressions[i], genv, &in);
+            proc_pop_roots(genv->proc, 1);
         }
         print_obj(res);
+        proc_release_source(genv->proc, &in);
     }
 }
 
@@ -174,17 +180,45 @@ int tlisp_file(const char *fname, env_t *genv)
     genv->proc->line_info = &source.line_info;
     for (i = 0; i < source.nexpressions; i++) {
         genv->proc->curr_expr = source.expressions[i];
-        eval(source.expressions[i], genv);
+        proc_push_root(genv->proc, &source.expressions[i]);
+        run(source.expressions[i], genv, &source);
+        proc_pop_roots(genv->proc, 1);
     }
+    proc_release_source(genv->proc, &source);
     return 0;
 }
 
+static
+size_t parse_size(const char *str)
+{
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+    }
+    if (end == str || *end) {
+        fprintf(stderr, "ERROR: Invalid size %s.\n", str);
+        exit(1);
+    }
+    return size;
+}
+
 static
 void print_usage(const char *progname)
 {
     printf("USAGE: %s [options] [file]\n", progname);
     printf("\t-h Print this help message\n");
     printf("\t-i Run interactive REPL\n");
+    printf("\t-b Compile to bytecode and run it on the VM\n");
+    printf("\t-p <usec> Collect incrementally, pausing at most usec at a time\n");
+    printf("\t-t <n> Use n threads for full collections\n");
+    printf("\t-g <file> Log each collection to file (- for stderr)\n");
+    printf("\t-H <size> Initial heap size, e.g. 16M\n");
+    printf("\t-M <size> Maximum heap size (default 4G)\n");
+    printf("\t-G <factor> Grow the heap by factor times the live set between full collections\n");
 }
 
 int main(int argc, char **argv)
@@ -192,6 +226,13 @@ int main(int argc, char **argv)
     int i;
     int help = 0;
     int interactive = 0;
+    long pause_us = 0;
+    int gc_threads = 1;
+    const char *trace = getenv("TLISP_GC_TRACE");
+    size_t init_heap = 0;
+    size_t max_heap = HEAP_DEFAULT_MAX;
+    double growth = GC_GROWTH;
+    const char *fname = NULL;
     process_t proc;
     env_t genv;
 
@@ -202,17 +243,54 @@ int main(int argc, char **argv)
     for (i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-h"))
             help = 1;
-        if (!strcmp(argv[i], "-i"))
+        else if (!strcmp(argv[i], "-i"))
             interactive = 1;
+        else if (!strcmp(argv[i], "-b"))
+            use_vm = 1;
+        else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+            pause_us = atol(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            gc_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+            trace = argv[++i];
+        else if (!strcmp(argv[i], "-H") && i + 1 < argc)
+            init_heap = parse_size(argv[++i]);
+        else if (!strcmp(argv[i], "-M") && i + 1 < argc)
+            max_heap = parse_size(argv[++i]);
+        else if (!strcmp(argv[i], "-G") && i + 1 < argc)
+            growth = atof(argv[++i]);
+        else if (!fname)
+            fname = argv[i];
     }
-    if (help) {
+    if (help || (!interactive && !fname)) {
         print_usage(argv[0]);
         return 0;
     }
+    if (max_heap < HEAP_PAGE_SIZE || init_heap > max_heap) {
+        fprintf(stderr, "ERROR: Invalid heap size.\n");
+        return 1;
+    }
+    if (growth < 1.0) {
+        fprintf(stderr, "ERROR: Growth factor must be at least 1.\n");
+        return 1;
+    }
     proc_init(&proc);
+    proc.gc_pause_us = pause_us;
+    proc.gc_threads = gc_threads > 0 ? gc_threads : 1;
+    proc.gc_growth = growth;
+    proc.heap.init_pages = (init_heap + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE;
+    proc.heap.max_pages = max_heap / HEAP_PAGE_SIZE;
+    proc.gc_threshold = gc_min_threshold(&proc);
+    if (trace && *trace) {
+        proc.gc_trace = strcmp(trace, "-") ? fopen(trace, "w") : stderr;
+        if (!proc.gc_trace) {
+            fprintf(stderr, "ERROR: Unable to open %s.\n", trace);
+            return 1;
+        }
+    }
     genv_init(&genv, &proc);
     if (interactive) {
         return tlisp_repl(&genv);
     }
-    return tlisp_file(argv[1], &genv);
+    return tlisp_file(fname, &genv);
 }
@@ -1,20 +1,25 @@
 
 #include "core.h"
+#include "pool.h"
 #include "vector.h"
 #include <stdlib.h>
+#include <string.h>
 
 #define MIN_CAP 8
 
-void vec_init(tlisp_vector_t *vec)
+void vec_init(tlisp_vector_t *vec, tlisp_obj_t **elems, int cap)
 {
     vec->len = 0;
-    vec->cap = MIN_CAP;
-    vec->elems = malloc(sizeof(tlisp_obj_t *) * vec->cap);
+    vec->cap = cap;
+    vec->elems = elems;
+    vec->is_inline = 1;
 }
 
 void vec_destroy(tlisp_vector_t *vec)
 {
-    free(vec->elems);
+    if (!vec->is_inline) {
+        pool_free(vec->elems);
+    }
 }
 
 static
@@ -22,13 +27,20 @@ void vec_check_resize(tlisp_vector_t *vec)
 {
     if (vec->len == vec->cap) {
         vec->cap *= 2;
-        vec->elems = realloc(vec->elems, sizeof(tlisp_obj_t *) * vec->cap);
+        if (vec->is_inline) {
+            tlisp_obj_t **elems = pool_alloc(sizeof(tlisp_obj_t *) * vec->cap);
+            memcpy(elems, vec->elems, sizeof(tlisp_obj_t *) * vec->len);
+            vec->elems = elems;
+            vec->is_inline = 0;
+        } else {
+            vec->elems = pool_realloc(vec->elems, sizeof(tlisp_obj_t *) * vec->cap);
+        }
         return;
     }
 
-    if ((vec->len <= vec->cap / 4) && (vec->cap / 2 >= MIN_CAP)) {
+    if (!vec->is_inline && (vec->len <= vec->cap / 4) && (vec->cap / 2 >= MIN_CAP)) {
         vec->cap /= 2;
-        vec->elems = realloc(vec->elems, sizeof(tlisp_obj_t *) * vec->cap);
+        vec->elems = pool_realloc(vec->elems, sizeof(tlisp_obj_t *) * vec->cap);
         return;
     }
 }
@@ -48,7 +60,7 @@ int vec_ins_at(tlisp_vector_t *vec, tlisp_obj_t *obj, int idx)
         return 0;
     }
     vec_check_resize(vec);
-    for (i = vec->len; i >= idx; i--) {
+    for (i = vec->len - 1; i >= idx; i--) {
         vec->elems[i + 1] = vec->elems[i];
     }
     vec->elems[idx] = obj;
@@ -3,15 +3,20 @@
 
 typedef struct tlisp_obj_t tlisp_obj_t;
 
+// A vector starts out in storage inside its object and moves to a
+// pool allocation once it outgrows it.
+#define VEC_INLINE_CAP 8
+
 typedef struct tlisp_vector_t {
     int len;
     int cap;
     tlisp_obj_t **elems;
+    char is_inline;
 } tlisp_vector_t;
 
 typedef void (*vec_visitor)(tlisp_obj_t *, void *);
 
-void vec_init(tlisp_vector_t *);
+void vec_init(tlisp_vector_t *, tlisp_obj_t **elems, int cap);
 void vec_destroy(tlisp_vector_t *);
 void vec_ins(tlisp_vector_t *, tlisp_obj_t *);
 int vec_ins_at(tlisp_vector_t *, tlisp_obj_t *, int);
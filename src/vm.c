@@ -0,0 +1,303 @@
+
+#include "builtins.h"
+#include "process.h"
+#include "vm.h"
+#include <stdio.h>
+
+#ifdef __GNUC__
+// Labels as values are a GNU extension.
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_LABEL(op) &&do_##op,
+#define CASE(op) do_##op:
+#define NEXT goto *labels[*ip++]
+#define DISPATCH NEXT;
+#else
+#define CASE(op) case op:
+#define NEXT break
+#define DISPATCH for (;;) switch (*ip++)
+#endif
+
+#define PUSH(obj) (*sp++ = (obj))
+#define POP() (*--sp)
+#define TOP() (sp[-1])
+#define OPERAND() (*ip++)
+
+// Publishes the stack depth, so the collector sees every value on the
+// stack, before anything that might allocate.
+#define SYNC() (proc->vm_sp = sp - proc->vm_stack)
+
+static
+tlisp_obj_t *lookup(env_t *env, tlisp_obj_t *sym)
+{
+    tlisp_obj_t *obj = env_find(env, sym);
+
+    if (!obj) {
+        char errstr[256];
+        snprintf(errstr, 256, "ERROR: Undefined symbol '%s'.\n", sym->sym);
+        proc_fatal(env->proc, errstr);
+    }
+    return obj;
+}
+
+tlisp_obj_t *vm_run(vm_chunk_t *chunk, env_t *env)
+{
+#ifdef __GNUC__
+    static void *labels[] = { VM_OPS(VM_LABEL) };
+#endif
+    process_t *proc = env->proc;
+    globals_t *globals = &proc->genv->globals;
+    env_t *frame = env;
+    int base = proc->vm_sp;
+    intptr_t *code = chunk->code;
+    intptr_t *ip = code;
+    tlisp_obj_t **sp = proc->vm_stack + base;
+    int nenvs = chunk->max_envs ? chunk->max_envs : 1;
+    env_t envs[nenvs];
+    int ed = 0;
+    tlisp_obj_t *running = NULL;
+    tlisp_obj_t *obj;
+    tlisp_obj_t *res;
+
+    if (base + chunk->max_stack > VM_STACK_SIZE) {
+        proc_fatal(proc, "ERROR: Stack overflow.\n");
+    }
+
+    DISPATCH {
+    CASE(VM_CONST) {
+        PUSH((tlisp_obj_t *)OPERAND());
+        NEXT;
+    }
+    CASE(VM_LOOKUP) {
+        PUSH(lookup(env, (tlisp_obj_t *)OPERAND()));
+        NEXT;
+    }
+    CASE(VM_LOCAL) {
+        tlisp_obj_t *sym = (tlisp_obj_t *)OPERAND();
+
+        obj = env_find_slot(env, sym, OPERAND());
+        PUSH(obj ? obj : lookup(env, sym));
+        NEXT;
+    }
+    CASE(VM_POP) {
+        sp--;
+        NEXT;
+    }
+    CASE(VM_JUMP) {
+        ip = code + *ip;
+        NEXT;
+    }
+    CASE(VM_JUMP_UNLESS) {
+        if (POP() == tlisp_true) {
+            ip++;
+        } else {
+            ip = code + *ip;
+        }
+        NEXT;
+    }
+    CASE(VM_GUARD) {
+        tlisp_obj_t *sym = (tlisp_obj_t *)OPERAND();
+
+        obj = (tlisp_obj_t *)OPERAND();
+        if (sym->sym_frames || globals->vals[sym->sym_id] != obj) {
+            ip = code + *ip;
+        } else {
+            ip++;
+        }
+        NEXT;
+    }
+    CASE(VM_DEF) {
+        env_add(env, (tlisp_obj_t *)OPERAND(), TOP());
+        NEXT;
+    }
+    CASE(VM_SET) {
+        tlisp_obj_t *sym = (tlisp_obj_t *)OPERAND();
+
+        if (!env_update(env, sym, TOP())) {
+            char errstr[128];
+            snprintf(errstr, 128, "ERROR: No previous value for symbol %s.\n", sym->sym);
+            proc_fatal(proc, errstr);
+        }
+        NEXT;
+    }
+    CASE(VM_LAMBDA) {
+        tlisp_obj_t *form = (tlisp_obj_t *)OPERAND();
+
+        SYNC();
+        obj = tlisp_lambda(form->cdr, env);
+        obj->code = (vm_chunk_t *)OPERAND();
+        PUSH(obj);
+        NEXT;
+    }
+    CASE(VM_NATIVE) {
+        tlisp_obj_t *form = (tlisp_obj_t *)OPERAND();
+        tlisp_fn fn = (tlisp_fn)OPERAND();
+
+        SYNC();
+        PUSH(fn(form->cdr, env));
+        NEXT;
+    }
+    CASE(VM_CALL) {
+        tlisp_obj_t *form = (tlisp_obj_t *)OPERAND();
+
+        obj = TOP();
+        if (OBJ_TAG(obj) == LAMBDA) {
+            // The parameters still to be bound sit above the lambda.
+            env_init(&envs[ed], env, proc);
+            env = &envs[ed];
+            ed++;
+            PUSH(obj->car);
+            ip++;
+        } else {
+            SYNC();
+            TOP() = apply_obj(obj, form->cdr, env);
+            ip = code + *ip;
+        }
+        NEXT;
+    }
+    CASE(VM_ARG) {
+        if (!TOP()) {
+            proc_fatal(proc, "ERROR: Too many arguments.\n");
+        }
+        NEXT;
+    }
+    CASE(VM_BIND_ARG) {
+        obj = POP();
+        env_add(env, TOP()->car, obj);
+        TOP() = TOP()->cdr;
+        NEXT;
+    }
+    CASE(VM_TAIL_ENTER) {
+        if (POP()) {
+            proc_fatal(proc, "ERROR: Too few arguments.\n");
+        }
+        obj = TOP();
+
+        // A call from the body of the lambda this chunk belongs to
+        // can take over its frame, as in run_lambda, and then run
+        // in place of it.
+        if (ed == 1 && env_shadows(env, frame)
+            && (!obj->code || obj->code->max_envs <= nenvs)) {
+            env_replace(frame, env);
+            env_destroy(&envs[0]);
+            ed = 0;
+            env = frame;
+            if (!running) {
+                proc_push_root(proc, &running);
+            }
+            running = obj;
+            if (!obj->code) {
+                SYNC();
+                res = run_lambda(obj, env);
+                goto done;
+            }
+            chunk = obj->code;
+            code = chunk->code;
+            ip = code;
+            sp = proc->vm_stack + base;
+            if (base + chunk->max_stack > VM_STACK_SIZE) {
+                proc_fatal(proc, "ERROR: Stack overflow.\n");
+            }
+            NEXT;
+        }
+        goto enter;
+    }
+    CASE(VM_ENTER) {
+        if (POP()) {
+            proc_fatal(proc, "ERROR: Too few arguments.\n");
+        }
+        obj = TOP();
+    enter:
+        SYNC();
+        res = run_lambda(obj, env);
+        TOP() = res;
+        env = env->outer;
+        ed--;
+        env_destroy(&envs[ed]);
+        NEXT;
+    }
+    CASE(VM_LET) {
+        env_init(&envs[ed], env, proc);
+        ed++;
+        NEXT;
+    }
+    CASE(VM_BIND) {
+        obj = POP();
+        env_add(&envs[ed - 1], (tlisp_obj_t *)OPERAND(), obj);
+        NEXT;
+    }
+    CASE(VM_LET_BODY) {
+        env = &envs[ed - 1];
+        NEXT;
+    }
+    CASE(VM_LET_END) {
+        env = env->outer;
+        ed--;
+        env_destroy(&envs[ed]);
+        NEXT;
+    }
+    CASE(VM_ASSERT_NUM) {
+        assert_num(TOP(), proc);
+        NEXT;
+    }
+    CASE(VM_ARITH) {
+        SYNC();
+        obj = arith(OPERAND(), sp[-2], sp[-1], proc);
+        sp--;
+        TOP() = obj;
+        NEXT;
+    }
+    CASE(VM_COMPARE) {
+        obj = num_compare(OPERAND(), sp[-2], sp[-1], proc);
+        sp--;
+        TOP() = obj;
+        NEXT;
+    }
+    CASE(VM_EQ) {
+        obj = eq_values(sp[-2], sp[-1]);
+        sp--;
+        TOP() = obj;
+        NEXT;
+    }
+    CASE(VM_NOT) {
+        TOP() = bool_not(TOP(), proc);
+        NEXT;
+    }
+    CASE(VM_CAR) {
+        TOP() = car_of(TOP(), proc);
+        NEXT;
+    }
+    CASE(VM_CDR) {
+        TOP() = cdr_of(TOP(), proc);
+        NEXT;
+    }
+    CASE(VM_EVAL) {
+        SYNC();
+        PUSH(eval((tlisp_obj_t *)OPERAND(), env));
+        NEXT;
+    }
+    CASE(VM_RETURN) {
+        res = POP();
+        goto done;
+    }
+#ifndef __GNUC__
+    default:
+        break;
+    }
+#else
+    }
+#endif
+
+done:
+    // The running lambda is rooted once it's taken over by a tail
+    // call, so that its chunk's arena stays alive.
+    if (running) {
+        proc_pop_roots(proc, 1);
+    }
+    proc->vm_sp = base;
+    return res;
+}
+
+tlisp_obj_t *vm_eval(tlisp_obj_t *expr, env_t *env, arena_t *arena)
+{
+    return vm_run(vm_compile(expr, env, arena), env);
+}
@@ -0,0 +1,71 @@
+#ifndef TLISP_VM_H_
+#define TLISP_VM_H_
+
+#include "arena.h"
+#include "core.h"
+#include "env.h"
+#include <stdint.h>
+
+// A second engine for running tlisp code. Each top-level expression
+// is compiled to bytecode for a stack machine, and every lambda
+// defined in it gets its own chunk, run whenever the lambda is
+// called. Special forms, arithmetic and comparisons are compiled
+// inline; other builtins are still called with their unevaluated
+// arguments, as they are by eval.
+//
+// Builtins named in the code are resolved when it's compiled, and
+// checked each time the code runs: if a frame has since bound the
+// name, or set! rebound it, the form is handed to eval instead.
+
+// Operands follow their opcode in the code, one word each.
+#define VM_OPS(X)                                                       \
+    X(VM_CONST)         /* obj: Push obj. */                            \
+    X(VM_LOOKUP)        /* sym: Push sym's value. */                    \
+    X(VM_LOCAL)         /* sym slot: Same, trying slot first. */        \
+    X(VM_POP)                                                           \
+    X(VM_JUMP)          /* target */                                    \
+    X(VM_JUMP_UNLESS)   /* target: Pop, and jump unless true. */        \
+    X(VM_GUARD)         /* sym obj target: Jump unless sym means obj. */ \
+    X(VM_DEF)           /* sym: Bind sym to the top. */                 \
+    X(VM_SET)           /* sym: Update sym to the top. */               \
+    X(VM_LAMBDA)        /* form chunk: Push a lambda running chunk. */  \
+    X(VM_NATIVE)        /* form fn: Call the builtin fn on form's args. */ \
+    X(VM_CALL)          /* form target: Start a call to the top. */     \
+    X(VM_ARG)           /* Check for a parameter to bind. */            \
+    X(VM_BIND_ARG)      /* Bind the top to the next parameter. */       \
+    X(VM_ENTER)         /* Run the called lambda's body. */             \
+    X(VM_TAIL_ENTER)    /* Same, from tail position. */                 \
+    X(VM_LET)           /* Open a let's env. */                         \
+    X(VM_BIND)          /* sym: Bind sym in the let's env to the top. */ \
+    X(VM_LET_BODY)      /* Run in the let's env. */                     \
+    X(VM_LET_END)                                                       \
+    X(VM_ASSERT_NUM)                                                    \
+    X(VM_ARITH)         /* op */                                        \
+    X(VM_COMPARE)       /* op */                                        \
+    X(VM_EQ)                                                            \
+    X(VM_NOT)                                                           \
+    X(VM_CAR)                                                           \
+    X(VM_CDR)                                                           \
+    X(VM_EVAL)          /* expr: Push what eval makes of expr. */       \
+    X(VM_RETURN)
+
+#define VM_ENUM(op) op,
+enum vm_op_t {
+    VM_OPS(VM_ENUM)
+    VM_NOPS
+};
+
+typedef struct vm_chunk_t {
+    intptr_t *code;
+    int len;
+    int max_stack; /* Deepest the value stack gets. */
+    int max_envs;  /* Most envs open at once. */
+} vm_chunk_t;
+
+// Chunks are allocated in the arena the expression was read into,
+// so they live exactly as long as the code they were compiled from.
+vm_chunk_t *vm_compile(tlisp_obj_t *expr, env_t *, arena_t *);
+tlisp_obj_t *vm_run(vm_chunk_t *, env_t *);
+tlisp_obj_t *vm_eval(tlisp_obj_t *expr, env_t *, arena_t *);
+
+#endif